@@ -1,174 +1,2809 @@
 #include <lv2/core/lv2.h>
 #include <lv2/atom/atom.h>
 #include <lv2/atom/util.h>
+#include <lv2/atom/forge.h>
 #include <lv2/midi/midi.h>
 #include <lv2/urid/urid.h>
+#include <lv2/worker/worker.h>
+#include <lv2/state/state.h>
+#include <lv2/patch/patch.h>
 #include <sndfile.h>
 
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <time.h>
+
 #include <vector>
 #include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
 #include <cstring>
+#include <cerrno>
 #include <cstdlib>
 #include <cstdio>
 #include <string>
 #include <algorithm>
 #include <cstdint>
+#include <cctype>
+#include <cmath>
+#include <system_error>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #define MYDRUMKIT_URI "http://realsigmamusic.com/plugins/mydrumkit"
 #define NUM_OUTPUTS 12
 #define MAX_VOICES 64
+#define MAX_RELEASE_VOICES 16  // vozes extras para as rampas de release
+#define RELEASE_MS 5           // duração da rampa de choke/roubo
+#define MAX_CHOKE_GROUPS 32    // ids 1-31: cabem em uma máscara de 32 bits
+#define PORT_PROGRESS (NUM_OUTPUTS + 1)
+#define PORT_TELEMETRY (NUM_OUTPUTS + 2)
+#define PORT_GAIN (NUM_OUTPUTS + 3)          // nível de cada saída (dB), uma porta por saída
+#define PORT_BLEED (PORT_GAIN + NUM_OUTPUTS) // nível geral do bleed (dB)
+#define PORT_ACTIVITY (PORT_BLEED + 1)       // saídas com som no bloco (máscara de bits)
+
+// Matriz de saídas (ver Kit::sends)
+#define MAX_BUSES 32        // barramentos por kit; dois kits cabem em uma máscara de 64 bits
+#define BUS_FRAMES 1024     // frames por barramento: blocos maiores são processados em trechos
+#define GAIN_SMOOTH_MS 20   // duração da rampa a cada mudança de nível
+#define GAIN_MIN_DB -60.0f  // nível mínimo das portas (mudo)
+
+// Streaming do disco (modo opcional, ver MYDRUMKIT_STREAM_MS)
+#define STREAM_RING_FRAMES 8192   // buffer circular por voz (potência de 2)
+#define STREAM_CHUNK_FRAMES 2048  // frames lidos do disco por vez
+#define STREAM_QUEUE_SIZE 256     // pedidos pendentes da thread de áudio (potência de 2)
+#define STREAM_WAKE_MS 2          // intervalo máximo entre varreduras da thread leitora
+
+// Corte de silêncio (ver trim_silence): níveis de velocity com fim próprio,
+// um a cada 6 dB abaixo do ganho máximo, e fade no fim do sample cortado
+#define TRIM_LEVELS 8
+#define TRIM_FADE_MS 5
+
+// Formato dos dados de um sample na memória (ver MYDRUMKIT_STORAGE)
+enum SampleFormat : uint32_t {
+    SAMPLE_FLOAT = 0,  // float de 32 bits
+    SAMPLE_INT16 = 1,  // int16 com escala por sample (valor = pcm * scale)
+};
+
+static size_t sample_format_size(SampleFormat format) {
+    return format == SAMPLE_INT16 ? sizeof(int16_t) : sizeof(float);
+}
 
 // Estrutura de um sample carregado (mono ou estéreo)
+//
+// É uma visão imutável: os dados pertencem a `storage` (memória própria ou
+// o cache de kit mapeado, ver KitCacheMap) e estão no formato `format`. No
+// modo streaming, dataL/dataR guardam apenas o início do sample; os frames a
+// partir de `resident` são lidos durante a execução (de srcL/srcR se
+// mapeados, senão de `path`).
 struct Sample {
-    std::vector<float> dataL;  // canal esquerdo (ou mono)
-    std::vector<float> dataR;  // canal direito (vazio se mono)
+    const void* dataL;         // canal esquerdo (ou mono)
+    const void* dataR;         // canal direito (nullptr se mono)
+    uint32_t resident;         // frames acessíveis em dataL/dataR
+    uint32_t frames;           // duração total (residente + streaming)
     int channels;
     int sampleRate;
     bool is_stereo;
+    SampleFormat format;
+    float scale;               // SAMPLE_INT16: fator de conversão para float
+    uint32_t trimmed;          // frames de silêncio removidos do fim
+    uint32_t level_end[TRIM_LEVELS];  // fim audível com ganho <= 2^-k (UINT32_MAX = sem análise)
+    std::string path;          // arquivo de origem (streaming)
+    int file_channels;         // canais no arquivo de origem
+    const void* srcL;          // sample completo no cache mapeado (ou nullptr), mesmo formato
+    const void* srcR;
+    std::shared_ptr<const void> storage;
+
+    Sample() : dataL(nullptr), dataR(nullptr), resident(0), frames(0), channels(0), sampleRate(0),
+               is_stereo(false), format(SAMPLE_FLOAT), scale(1.0f), trimmed(0), file_channels(0),
+               srcL(nullptr), srcR(nullptr) {
+        for (int k = 0; k < TRIM_LEVELS; ++k) level_end[k] = UINT32_MAX;
+    }
+
+    bool empty() const { return !dataL || resident == 0; }
+    bool streamed() const { return frames > resident; }
+    size_t frame_bytes() const { return sample_format_size(format) * channels; }
+
+    // Fim efetivo para uma voz com ganho `gain`: depois dele o sinal fica
+    // abaixo do limiar de silêncio e a voz pode ser encerrada
+    uint32_t end_for(float gain) const {
+        int k = 0;
+        while (k + 1 < TRIM_LEVELS && gain <= 0.5f) {
+            gain *= 2.0f;
+            ++k;
+        }
+        return std::min(frames, level_end[k]);
+    }
+};
+
+// Arena de áudio: uma única região anônima (mmap) onde ficam os planos de
+// todos os samples decodificados em uma carga, cada um alinhado em
+// SAMPLE_ARENA_ALIGN bytes. Substitui uma alocação por sample: sem
+// fragmentação do heap e com as páginas já tocadas na carga. A capacidade é
+// só reservada (as páginas não usadas nunca são ocupadas) e o excesso é
+// devolvido em finish(). Opcionalmente usa huge pages e/ou mlock
+// (MYDRUMKIT_MEMORY), para que nenhum acesso da thread de áudio gere page fault.
+#define SAMPLE_ARENA_ALIGN 64
+#define SAMPLE_ARENA_HUGE_PAGE (2u << 20)
+
+class SampleArena {
+public:
+    ~SampleArena() {
+        if (!base) return;
+        if (locked) munlock(base, locked);
+        munmap(base, capacity);
+    }
+
+    static std::shared_ptr<SampleArena> create(size_t bytes, bool huge_pages) {
+        if (bytes == 0) return nullptr;
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t cap = (bytes + page - 1) / page * page;
+        void* mem = MAP_FAILED;
+        bool hugetlb = false;
+        if (huge_pages) {
+            // Páginas reservadas no sistema (hugetlbfs); sem elas, huge pages transparentes
+            size_t huge_cap = (bytes + SAMPLE_ARENA_HUGE_PAGE - 1) / SAMPLE_ARENA_HUGE_PAGE * SAMPLE_ARENA_HUGE_PAGE;
+            mem = mmap(nullptr, huge_cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (mem != MAP_FAILED) {
+                cap = huge_cap;
+                hugetlb = true;
+            }
+        }
+        if (mem == MAP_FAILED) {
+            mem = mmap(nullptr, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (mem == MAP_FAILED) return nullptr;
+#ifdef MADV_HUGEPAGE
+            if (huge_pages) madvise(mem, cap, MADV_HUGEPAGE);
+#endif
+        }
+        std::shared_ptr<SampleArena> arena(new SampleArena());
+        arena->base = (uint8_t*)mem;
+        arena->capacity = cap;
+        arena->hugetlb = hugetlb;
+        return arena;
+    }
+
+    // Reserva `bytes` alinhados (thread-safe). nullptr se a arena está cheia.
+    void* alloc(size_t bytes) {
+        size_t size = (bytes + SAMPLE_ARENA_ALIGN - 1) & ~(size_t)(SAMPLE_ARENA_ALIGN - 1);
+        size_t off = used.fetch_add(size);
+        if (off + size > capacity) return nullptr;
+        return base + off;
+    }
+
+    // Fim da carga: devolve a capacidade não usada e, se pedido, trava as
+    // páginas usadas na memória. Depois disso a arena não recebe mais dados.
+    void finish(bool lock) {
+        size_t n = std::min(used.load(), capacity);
+        size_t page = hugetlb ? SAMPLE_ARENA_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+        size_t keep = (n + page - 1) / page * page;
+        used.store(capacity);
+        bytes_used = n;
+        if (keep == 0) {
+            // Nada foi decodificado (samples já no processo ou no cache de kit)
+            munmap(base, capacity);
+            base = nullptr;
+            return;
+        }
+        if (keep < capacity && munmap(base + keep, capacity - keep) == 0) capacity = keep;
+        if (lock && n) {
+            if (mlock(base, n) == 0) locked = n;
+            else fprintf(stderr, "MyDrumKit: AVISO - mlock da arena de samples falhou: %s\n", strerror(errno));
+        }
+    }
+
+    size_t size() const { return bytes_used; }
+    bool huge() const { return hugetlb; }
+    bool is_locked() const { return locked != 0; }
+
+private:
+    SampleArena() : base(nullptr), capacity(0), used(0), bytes_used(0), locked(0), hugetlb(false) {}
+
+    uint8_t* base;
+    size_t capacity;
+    std::atomic<size_t> used;
+    size_t bytes_used;
+    size_t locked;
+    bool hugetlb;
+};
+
+// Aponta dataL/dataR para `frames` frames (no formato do sample): na arena,
+// se houver e couber, senão em memória própria
+static void allocate_sample(Sample& s, uint32_t frames, const std::shared_ptr<SampleArena>& arena = nullptr) {
+    if (arena) {
+        size_t plane = (size_t)frames * sample_format_size(s.format);
+        void* l = arena->alloc(plane);
+        void* r = s.is_stereo && l ? arena->alloc(plane) : nullptr;
+        if (l && (r || !s.is_stereo)) {
+            s.dataL = l;
+            s.dataR = r;
+            s.resident = frames;
+            s.storage = arena;
+            return;
+        }
+    }
+
+    size_t n = (size_t)frames * (s.is_stereo ? 2 : 1);
+    if (s.format == SAMPLE_INT16) {
+        auto buf = std::make_shared<std::vector<int16_t>>(n);
+        s.dataL = buf->data();
+        s.dataR = s.is_stereo ? buf->data() + frames : nullptr;
+        s.storage = buf;
+    } else {
+        auto buf = std::make_shared<std::vector<float>>(n);
+        s.dataL = buf->data();
+        s.dataR = s.is_stereo ? buf->data() + frames : nullptr;
+        s.storage = buf;
+    }
+    s.resident = frames;
+}
+
+// Remove o silêncio do fim de um sample float totalmente residente: tudo o
+// que fica abaixo de `threshold_db` (dBFS) depois do último trecho audível,
+// deixando TRIM_FADE_MS de fade até zero. Também calcula, para cada nível
+// de ganho 2^-k, o último frame que ainda passa do limiar (Sample::end_for).
+static void trim_silence(Sample& s, float threshold_db) {
+    if (s.format != SAMPLE_FLOAT || s.streamed() || s.empty() || threshold_db >= 0.0f) return;
+
+    const float* L = (const float*)s.dataL;
+    const float* R = (const float*)s.dataR;
+    float threshold = powf(10.0f, threshold_db / 20.0f);
+    float level[TRIM_LEVELS];
+    uint32_t last[TRIM_LEVELS];  // índice + 1 da última amostra acima de cada nível (0 = nenhuma)
+    for (int k = 0; k < TRIM_LEVELS; ++k) {
+        level[k] = threshold * (float)(1u << k);
+        last[k] = 0;
+    }
+
+    // Varre de trás para frente até achar o nível mais alto (os mais baixos terminam depois)
+    for (uint32_t i = s.frames; i-- > 0 && last[TRIM_LEVELS - 1] == 0;) {
+        float a = std::fabs(L[i]);
+        if (R) a = std::max(a, std::fabs(R[i]));
+        for (int k = 0; k < TRIM_LEVELS && a > level[k]; ++k) {
+            if (last[k] == 0) last[k] = i + 1;
+        }
+    }
+    if (last[0] == 0) return;  // sample inteiro abaixo do limiar: mantém como está
+
+    uint32_t fade = (uint32_t)((uint64_t)TRIM_FADE_MS * s.sampleRate / 1000);
+    uint32_t end = (uint32_t)std::min<uint64_t>(s.frames, (uint64_t)last[0] + fade);
+    s.level_end[0] = end;
+    for (int k = 1; k < TRIM_LEVELS; ++k) s.level_end[k] = std::min(end, last[k]);
+    if (end == s.frames) return;
+
+    // Copia a parte audível para um buffer do tamanho certo e aplica o fade
+    Sample out = s;
+    allocate_sample(out, end);
+    out.frames = end;
+    out.trimmed = s.trimmed + (s.frames - end);
+    for (int c = 0; c < s.channels; ++c) {
+        const float* src = c ? R : L;
+        float* dst = (float*)(c ? out.dataR : out.dataL);
+        std::memcpy(dst, src, end * sizeof(float));
+        uint32_t n = end - last[0];
+        for (uint32_t j = 0; j < n; ++j) dst[last[0] + j] *= (float)(n - j) / (float)(n + 1);
+    }
+    s = out;
+}
+
+// Converte um sample float para int16 com escala pelo pico e dither TPDF
+// (o ruído de quantização fica descorrelacionado do sinal nas caudas). O
+// gerador de dither tem semente fixa: a conversão é determinística.
+static Sample encode_int16(const Sample& in) {
+    Sample out = in;
+    out.format = SAMPLE_INT16;
+    out.srcL = out.srcR = nullptr;
+    allocate_sample(out, in.resident);
+
+    float peak = 0.0f;
+    for (int c = 0; c < in.channels; ++c) {
+        const float* src = (const float*)(c ? in.dataR : in.dataL);
+        for (uint32_t i = 0; i < in.resident; ++i) peak = std::max(peak, std::fabs(src[i]));
+    }
+    // Margem de 1 LSB para o dither não saturar no pico
+    out.scale = peak > 0.0f ? peak / 32766.0f : 1.0f;
+    float inv = 1.0f / out.scale;
+
+    uint32_t rnd = 0x2545F491u;
+    for (int c = 0; c < in.channels; ++c) {
+        const float* src = (const float*)(c ? in.dataR : in.dataL);
+        int16_t* dst = (int16_t*)(c ? out.dataR : out.dataL);
+        for (uint32_t i = 0; i < in.resident; ++i) {
+            rnd = rnd * 1664525u + 1013904223u;
+            float r1 = (float)(rnd >> 8) * (1.0f / 16777216.0f);
+            rnd = rnd * 1664525u + 1013904223u;
+            float r2 = (float)(rnd >> 8) * (1.0f / 16777216.0f);
+            long q = lrintf(src[i] * inv + (r1 - r2));
+            dst[i] = (int16_t)std::max(-32767L, std::min(32767L, q));
+        }
+    }
+    return out;
+}
+
+// Copia a parte residente de um sample para a arena. Se não couber, o
+// sample continua na memória própria.
+static void pack_into_arena(Sample& s, const std::shared_ptr<SampleArena>& arena) {
+    if (!arena || s.empty()) return;
+    size_t bytes = (size_t)s.resident * sample_format_size(s.format);
+    void* l = arena->alloc(bytes);
+    void* r = s.is_stereo && l ? arena->alloc(bytes) : nullptr;
+    if (!l || (s.is_stereo && !r)) return;
+    std::memcpy(l, s.dataL, bytes);
+    if (r) std::memcpy(r, s.dataR, bytes);
+    s.dataL = l;
+    s.dataR = r;
+    s.storage = arena;
+}
+
+// Converte frames intercalados do arquivo para os canais do sample:
+// L/R separados se estéreo, ou média dos canais se mono
+static void convert_frames(const float* in, int file_channels, bool stereo,
+                           float* outL, float* outR, size_t n) {
+    if (stereo) {
+        for (size_t i = 0; i < n; ++i) {
+            outL[i] = in[i * file_channels + 0];      // Canal L
+            outR[i] = in[i * file_channels + 1];      // Canal R
+        }
+    } else if (file_channels == 1) {
+        std::memcpy(outL, in, n * sizeof(float));
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            float sum = 0.0f;
+            for (int c = 0; c < file_channels; ++c) {
+                sum += in[i * file_channels + c];
+            }
+            outL[i] = sum / (float)file_channels;
+        }
+    }
+}
+
+// Reamostrador polifásico de alta qualidade (sinc janelado por Kaiser)
+//
+// Usado só na carga, para converter os WAVs para a taxa do host: o run()
+// continua lendo os samples frame a frame, sem interpolação. A razão
+// dst/src é reduzida a L/M; o filtro protótipo tem L fases de `taps`
+// coeficientes (atenuação ~90 dB, banda passante até 94% do Nyquist menor)
+// e o atraso de grupo é compensado, de modo que o ataque não se desloca.
+#define RESAMPLE_TAPS 64          // coeficientes por fase (ao aumentar a taxa)
+#define RESAMPLE_MAX_PHASES 4096  // razões mais complexas que isso não são convertidas
+#define RESAMPLE_ROLLOFF 0.94
+#define RESAMPLE_KAISER_BETA 9.0
+
+class Resampler {
+public:
+    Resampler(uint32_t src_rate, uint32_t dst_rate) : L(0), M(0), taps(0) {
+        uint32_t a = src_rate, b = dst_rate;
+        while (b) {
+            uint32_t t = a % b;
+            a = b;
+            b = t;
+        }
+        if (a == 0 || dst_rate / a > RESAMPLE_MAX_PHASES) return;
+        L = dst_rate / a;
+        M = src_rate / a;
+
+        // Ao reduzir a taxa, o filtro fica mais longo na mesma proporção
+        double ratio = std::max(1.0, (double)M / L);
+        taps = ((uint32_t)std::ceil(RESAMPLE_TAPS * ratio) + 7) & ~7u;
+
+        // Protótipo na taxa intermediária src*L, com ganho L
+        uint32_t n = L * taps;
+        double fc = RESAMPLE_ROLLOFF * 0.5 / std::max(L, M);
+        // Centro inteiro, para que o atraso de grupo seja compensado exatamente
+        delay = (n - 1) / 2;
+        double center = delay;
+        double norm = bessel_i0(RESAMPLE_KAISER_BETA);
+        coefs.resize(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            double x = i - center;
+            double sinc = x == 0.0 ? 1.0 : std::sin(2.0 * M_PI * fc * x) / (2.0 * M_PI * fc * x);
+            double w = x / (n * 0.5);
+            double kaiser = bessel_i0(RESAMPLE_KAISER_BETA * std::sqrt(std::max(0.0, 1.0 - w * w))) / norm;
+            double h = 2.0 * fc * sinc * kaiser * L;
+            // Fase p = i % L, coeficiente k = i / L, guardado invertido para um produto escalar contíguo
+            coefs[(i % L) * taps + (taps - 1 - i / L)] = (float)h;
+        }
+        // Ganho DC exatamente 1 em todas as fases (sem modulação de nível)
+        for (uint32_t p = 0; p < L; ++p) {
+            double sum = 0.0;
+            for (uint32_t k = 0; k < taps; ++k) sum += coefs[p * taps + k];
+            for (uint32_t k = 0; k < taps; ++k) coefs[p * taps + k] = (float)(coefs[p * taps + k] / sum);
+        }
+    }
+
+    bool valid() const { return L != 0; }
+
+    uint32_t output_frames(uint32_t in_frames) const {
+        return (uint32_t)(((uint64_t)in_frames * L + M - 1) / M);
+    }
+
+    // Converte um canal inteiro: `out` deve ter output_frames(n_in) posições
+    void process(const float* in, uint32_t n_in, float* out) const {
+        // Entrada com `taps` zeros de cada lado, para dispensar testes de limite
+        std::vector<float> padded((size_t)n_in + 2 * taps, 0.0f);
+        std::memcpy(padded.data() + taps, in, (size_t)n_in * sizeof(float));
+
+        uint32_t n_out = output_frames(n_in);
+        for (uint32_t j = 0; j < n_out; ++j) {
+            uint64_t t = (uint64_t)j * M + delay;
+            uint64_t base = t / L;
+            const float* h = coefs.data() + (size_t)(t % L) * taps;
+            // Janela x[base - taps + 1 .. base], deslocada pelos zeros iniciais
+            out[j] = dot(padded.data() + base + 1, h, taps);
+        }
+    }
+
+private:
+    static double bessel_i0(double x) {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 50; ++k) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+            if (term < sum * 1e-12) break;
+        }
+        return sum;
+    }
+
+    static float dot(const float* x, const float* h, uint32_t n) {
+#if defined(__SSE__)
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        for (uint32_t i = 0; i < n; i += 8) {
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(h + i + 4)));
+        }
+        acc0 = _mm_add_ps(acc0, acc1);
+        acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+        acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+        return _mm_cvtss_f32(acc0);
+#else
+        float sum = 0.0f;
+        for (uint32_t i = 0; i < n; ++i) sum += x[i] * h[i];
+        return sum;
+#endif
+    }
+
+    uint32_t L, M;         // razão dst/src reduzida
+    uint32_t taps;         // coeficientes por fase (múltiplo de 8)
+    uint32_t delay;        // atraso de grupo do protótipo, na taxa intermediária
+    std::vector<float> coefs;
+};
+
+// Reamostrador compartilhado para um par de taxas (os coeficientes são calculados uma vez)
+static std::shared_ptr<const Resampler> get_resampler(uint32_t src_rate, uint32_t dst_rate) {
+    static std::mutex mutex;
+    static std::map<std::pair<uint32_t, uint32_t>, std::shared_ptr<const Resampler>> cache;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& slot = cache[std::make_pair(src_rate, dst_rate)];
+    if (!slot) slot = std::make_shared<const Resampler>(src_rate, dst_rate);
+    return slot;
+}
+
+// Núcleos disponíveis para este processo (respeita a afinidade/cpuset)
+static unsigned available_cpus() {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        int n = CPU_COUNT(&set);
+        if (n > 0) return (unsigned)n;
+    }
+    unsigned hw = std::thread::hardware_concurrency();
+    return hw ? hw : 1;
+}
+
+// Threads auxiliares de carga em uso no processo. Várias instâncias
+// carregando ao mesmo tempo dividem o mesmo limite (um thread por núcleo,
+// contando a thread de carga de cada instância), em vez de cada uma abrir
+// um thread por núcleo.
+static std::atomic<int> load_helpers_free(-1);
+
+static int acquire_load_helpers(int wanted) {
+    int expected = -1;
+    load_helpers_free.compare_exchange_strong(expected, (int)available_cpus() - 1);
+    int got = 0;
+    int free_now = load_helpers_free.load();
+    while (got < wanted && free_now > 0) {
+        if (load_helpers_free.compare_exchange_weak(free_now, free_now - 1)) ++got;
+    }
+    return got;
+}
+
+static void release_load_helpers(int n) {
+    load_helpers_free.fetch_add(n);
+}
+
+// Executa fn(i) para i em [0, n) na thread chamadora e em até um thread
+// auxiliar por núcleo livre. Os índices são distribuídos sob demanda; a
+// ordem de conclusão não é determinística.
+template <typename F>
+static void parallel_for(size_t n, F fn) {
+    if (n == 0) return;
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i; (i = next.fetch_add(1)) < n;) fn(i);
+    };
+
+    int helpers = acquire_load_helpers((int)std::min<size_t>(n - 1, INT_MAX));
+    std::vector<std::thread> threads;
+    try {
+        for (int t = 0; t < helpers; ++t) threads.emplace_back(worker);
+    } catch (const std::system_error& e) {
+        fprintf(stderr, "MyDrumKit: AVISO - threads de carga indisponíveis: %s\n", e.what());
+    }
+    release_load_helpers(helpers - (int)threads.size());
+    worker();
+    for (std::thread& t : threads) t.join();
+    release_load_helpers((int)threads.size());
+}
+
+// Fila lock-free de um produtor e um consumidor
+template <typename T, uint32_t N>
+class SpscQueue {
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    bool push(const T& item) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) >= N) return false;
+        items[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = items[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T items[N];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+};
+
+// Pedido da thread de áudio: iniciar o streaming de uma voz
+struct StreamRequest {
+    int slot;
+    uint32_t gen;
+    const Sample* sample;
+};
+
+// Buffer circular de uma voz: escrito pela thread leitora, lido pela de áudio.
+// As posições são frames absolutos do sample; o índice no buffer é
+// pos % STREAM_RING_FRAMES.
+struct VoiceStream {
+    std::vector<float> ringL;
+    std::vector<float> ringR;
+    std::atomic<uint32_t> write_pos;  // frames válidos até aqui (leitora)
+    std::atomic<uint32_t> read_pos;   // frames consumidos até aqui (áudio)
+    std::atomic<uint32_t> gen;        // geração pedida pela thread de áudio
+    std::atomic<uint32_t> ready_gen;  // geração já preparada pela leitora
+
+    // Estado privado da thread leitora
+    const Sample* sample;
+    SNDFILE* file;
+    uint32_t file_pos;
+    uint32_t reader_gen;
+
+    VoiceStream() : write_pos(0), read_pos(0), gen(0), ready_gen(0),
+                    sample(nullptr), file(nullptr), file_pos(0), reader_gen(0) {}
+};
+
+// Streaming do disco: uma thread leitora mantém cheio o buffer circular de
+// cada voz tocando um sample parcialmente residente. A thread de áudio nunca
+// bloqueia: se os dados não chegaram a tempo, toca silêncio, avança a posição
+// e conta um underrun (informado no log pela thread leitora).
+class Streamer {
+public:
+    Streamer() : streams(nullptr), n_streams(0), running(false), need_wake(false), quit(false), underruns(0),
+                 passes(0) {}
+    ~Streamer() { shutdown(); }
+
+    bool init(int voices) {
+        streams = new VoiceStream[voices];
+        n_streams = voices;
+        for (int i = 0; i < voices; ++i) {
+            streams[i].ringL.assign(STREAM_RING_FRAMES, 0.0f);
+            streams[i].ringR.assign(STREAM_RING_FRAMES, 0.0f);
+        }
+        if (sem_init(&wake, 0, 0) != 0) return false;
+        running = true;
+        reader = std::thread(&Streamer::reader_main, this);
+        return true;
+    }
+
+    void shutdown() {
+        if (running) {
+            quit.store(true);
+            sem_post(&wake);
+            reader.join();
+            sem_destroy(&wake);
+            running = false;
+        }
+        delete[] streams;
+        streams = nullptr;
+        n_streams = 0;
+    }
+
+    // Thread de áudio: inicia o streaming do slot a partir do fim da parte residente
+    void start(int slot, const Sample* sample) {
+        VoiceStream& st = streams[slot];
+        uint32_t gen = st.gen.load(std::memory_order_relaxed) + 1;
+        st.read_pos.store(sample->resident, std::memory_order_relaxed);
+        st.gen.store(gen, std::memory_order_release);
+        if (!requests.push({slot, gen, sample})) {
+            underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+        need_wake = true;
+    }
+
+    // Thread de áudio: a voz do slot terminou (ou foi cortada)
+    void stop(int slot) {
+        streams[slot].gen.fetch_add(1, std::memory_order_release);
+    }
+
+    // Thread de áudio: frames disponíveis a partir de `pos` (no máximo `n`)
+    uint32_t available(int slot, uint32_t pos, uint32_t n) const {
+        const VoiceStream& st = streams[slot];
+        if (st.ready_gen.load(std::memory_order_acquire) != st.gen.load(std::memory_order_relaxed)) return 0;
+        uint32_t w = st.write_pos.load(std::memory_order_acquire);
+        if (w <= pos) return 0;
+        return std::min(n, w - pos);
+    }
+
+    // Thread de áudio: libera o buffer até `pos` (pode saltar adiante após um underrun)
+    void consumed(int slot, uint32_t pos) {
+        streams[slot].read_pos.store(pos, std::memory_order_release);
+        need_wake = true;
+    }
+
+    // Thread de áudio: acorda a leitora no máximo uma vez por bloco
+    void flush() {
+        if (need_wake) {
+            need_wake = false;
+            sem_post(&wake);
+        }
+    }
+
+    void underrun() { underruns.fetch_add(1, std::memory_order_relaxed); }
+    uint32_t underrun_count() const { return underruns.load(std::memory_order_relaxed); }
+
+    // Fora da thread de áudio: espera a leitora completar uma varredura
+    // inteira, depois da qual ela não guarda mais ponteiros para samples de
+    // vozes já paradas (usado antes de liberar um kit antigo)
+    void sync() {
+        if (!running) return;
+        uint32_t start = passes.load(std::memory_order_acquire);
+        while (passes.load(std::memory_order_acquire) - start < 2) {
+            sem_post(&wake);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    const float* ringL(int slot) const { return streams[slot].ringL.data(); }
+    const float* ringR(int slot) const { return streams[slot].ringR.data(); }
+
+private:
+    void close_stream(VoiceStream& st) {
+        if (st.file) sf_close(st.file);
+        st.file = nullptr;
+        st.sample = nullptr;
+    }
+
+    void setup(const StreamRequest& req) {
+        VoiceStream& st = streams[req.slot];
+        if (req.gen != st.gen.load(std::memory_order_acquire)) return;  // pedido obsoleto
+
+        close_stream(st);
+        // Sem cache de kit mapeado, lê o restante do WAV de origem
+        if (!req.sample->srcL) {
+            SF_INFO info{};
+            st.file = sf_open(req.sample->path.c_str(), SFM_READ, &info);
+            if (!st.file) {
+                fprintf(stderr, "MyDrumKit: Streaming: erro ao abrir %s: %s\n",
+                        req.sample->path.c_str(), sf_strerror(nullptr));
+                return;
+            }
+        }
+        st.sample = req.sample;
+        st.file_pos = 0;
+        st.reader_gen = req.gen;
+        st.write_pos.store(req.sample->resident, std::memory_order_relaxed);
+        st.ready_gen.store(req.gen, std::memory_order_release);
+    }
+
+    // Copia n frames de um plano mapeado (a partir de `from`) para o buffer
+    // circular a partir de `idx`, dando a volta depois de `first` frames
+    static void copy_to_ring(float* ring, uint32_t idx, const Sample* s, const void* plane,
+                             uint32_t from, uint32_t first, uint32_t n) {
+        if (s->format == SAMPLE_INT16) {
+            const int16_t* src = (const int16_t*)plane + from;
+            for (uint32_t k = 0; k < first; ++k) ring[idx + k] = (float)src[k] * s->scale;
+            for (uint32_t k = first; k < n; ++k) ring[k - first] = (float)src[k] * s->scale;
+        } else {
+            const float* src = (const float*)plane + from;
+            std::memcpy(ring + idx, src, first * sizeof(float));
+            std::memcpy(ring, src + first, (n - first) * sizeof(float));
+        }
+    }
+
+    void fill(VoiceStream& st, std::vector<float>& tmp) {
+        if (!st.sample) return;
+        if (st.gen.load(std::memory_order_acquire) != st.reader_gen) {
+            close_stream(st);  // voz terminou ou slot reutilizado
+            return;
+        }
+
+        const Sample* s = st.sample;
+        uint32_t w = st.write_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            uint32_t r = st.read_pos.load(std::memory_order_acquire);
+            if (r > w) w = r;  // a thread de áudio saltou adiante (underrun)
+            if (w >= s->frames) {
+                st.write_pos.store(w, std::memory_order_release);
+                close_stream(st);
+                return;
+            }
+
+            uint32_t space = STREAM_RING_FRAMES - (w - r);
+            uint32_t n = std::min(std::min(space, (uint32_t)STREAM_CHUNK_FRAMES), s->frames - w);
+            if (n < STREAM_CHUNK_FRAMES / 4 && w + n < s->frames) break;  // espera liberar mais espaço
+
+            uint32_t idx = w & (STREAM_RING_FRAMES - 1);
+            uint32_t first = std::min(n, (uint32_t)STREAM_RING_FRAMES - idx);
+
+            if (s->srcL) {
+                // Cache de kit mapeado: os page faults acontecem aqui, não no run()
+                copy_to_ring(st.ringL.data(), idx, s, s->srcL, w, first, n);
+                if (s->srcR) copy_to_ring(st.ringR.data(), idx, s, s->srcR, w, first, n);
+            } else {
+                if (st.file_pos != w) {
+                    if (sf_seek(st.file, w, SEEK_SET) < 0) { close_stream(st); return; }
+                    st.file_pos = w;
+                }
+                tmp.resize((size_t)n * s->file_channels);
+                sf_count_t got = sf_readf_float(st.file, tmp.data(), n);
+                if (got <= 0) { close_stream(st); return; }
+                n = (uint32_t)got;
+                first = std::min(n, first);
+                st.file_pos += n;
+
+                // Copia para o buffer circular (em até dois trechos)
+                convert_frames(tmp.data(), s->file_channels, s->is_stereo,
+                               &st.ringL[idx], &st.ringR[idx], first);
+                if (n > first) {
+                    convert_frames(tmp.data() + (size_t)first * s->file_channels, s->file_channels, s->is_stereo,
+                                   &st.ringL[0], &st.ringR[0], n - first);
+                }
+            }
+
+            w += n;
+            st.write_pos.store(w, std::memory_order_release);
+        }
+    }
+
+    void reader_main() {
+        std::vector<float> tmp;
+        uint32_t reported = 0;
+        while (!quit.load()) {
+            timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += STREAM_WAKE_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+            sem_timedwait(&wake, &ts);
+
+            StreamRequest req;
+            while (requests.pop(req)) setup(req);
+            for (int i = 0; i < n_streams; ++i) fill(streams[i], tmp);
+            passes.fetch_add(1, std::memory_order_release);
+
+            uint32_t u = underruns.load(std::memory_order_relaxed);
+            if (u != reported) {
+                fprintf(stderr, "MyDrumKit: Streaming: %u underrun(s) (total %u)\n", u - reported, u);
+                reported = u;
+            }
+        }
+        for (int i = 0; i < n_streams; ++i) close_stream(streams[i]);
+    }
+
+    VoiceStream* streams;
+    int n_streams;
+    SpscQueue<StreamRequest, STREAM_QUEUE_SIZE> requests;
+    sem_t wake;
+    std::thread reader;
+    bool running;
+    bool need_wake;  // thread de áudio
+    std::atomic<bool> quit;
+    std::atomic<uint32_t> underruns;
+    std::atomic<uint32_t> passes;  // varreduras completas da leitora (ver sync)
+};
+
+// Kernels de mixagem: acumulam um trecho inteiro de uma voz nas saídas,
+// out[k] += src[k] * gain. A variante (escalar, SSE ou AVX2) é escolhida uma
+// vez no instantiate conforme a CPU; mono ou estéreo é decidido por voz.
+//
+// As variantes "16" leem samples int16 (SAMPLE_INT16) e convertem para
+// float dentro do laço; o ganho já inclui a escala do sample. `ramp` aplica
+// um ganho linear, out[k] += src[k] * (base + (left - k) * step): com base 0,
+// o ganho decrescente das rampas de release de choke e roubo de voz, que
+// depende só de quantos frames faltam, não de onde o trecho começa (a saída
+// não muda com o tamanho do bloco nem com os segmentos do render offline);
+// com base no ganho final, a suavização dos níveis da matriz de saídas.
+//
+// Não usam FMA: todas as variantes fazem a mesma multiplicação e soma em
+// float, e a saída é idêntica bit a bit em qualquer CPU.
+typedef void (*MixMonoFn)(float* out, const float* src, float gain, uint32_t n);
+typedef void (*MixStereoFn)(float* outL, float* outR, const float* srcL, const float* srcR,
+                            float gain, uint32_t n);
+typedef void (*MixMono16Fn)(float* out, const int16_t* src, float gain, uint32_t n);
+typedef void (*MixStereo16Fn)(float* outL, float* outR, const int16_t* srcL, const int16_t* srcR,
+                              float gain, uint32_t n);
+typedef void (*MixRampFn)(float* out, const float* src, float base, float left, float step, uint32_t n);
+
+struct MixKernels {
+    const char* name;
+    MixMonoFn mono;
+    MixStereoFn stereo;
+    MixMono16Fn mono16;
+    MixStereo16Fn stereo16;
+    MixRampFn ramp;
+};
+
+static void mix_mono_scalar(float* out, const float* src, float gain, uint32_t n) {
+    for (uint32_t k = 0; k < n; ++k) out[k] += src[k] * gain;
+}
+
+static void mix_stereo_scalar(float* outL, float* outR, const float* srcL, const float* srcR,
+                              float gain, uint32_t n) {
+    for (uint32_t k = 0; k < n; ++k) {
+        outL[k] += srcL[k] * gain;
+        outR[k] += srcR[k] * gain;
+    }
+}
+
+static void mix_mono16_scalar(float* out, const int16_t* src, float gain, uint32_t n) {
+    for (uint32_t k = 0; k < n; ++k) out[k] += (float)src[k] * gain;
+}
+
+static void mix_stereo16_scalar(float* outL, float* outR, const int16_t* srcL, const int16_t* srcR,
+                                float gain, uint32_t n) {
+    for (uint32_t k = 0; k < n; ++k) {
+        outL[k] += (float)srcL[k] * gain;
+        outR[k] += (float)srcR[k] * gain;
+    }
+}
+
+static void mix_ramp_scalar(float* out, const float* src, float base, float left, float step, uint32_t n) {
+    for (uint32_t k = 0; k < n; ++k) out[k] += src[k] * (base + (left - (float)k) * step);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MIX_HAVE_X86 1
+
+__attribute__((target("sse2")))
+static void mix_ramp_sse(float* out, const float* src, float base, float left, float step, uint32_t n) {
+    __m128 b = _mm_set1_ps(base);
+    __m128 s = _mm_set1_ps(step);
+    __m128 lane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    uint32_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m128 gain = _mm_add_ps(b, _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(left - (float)k), lane), s));
+        _mm_storeu_ps(out + k, _mm_add_ps(_mm_loadu_ps(out + k), _mm_mul_ps(_mm_loadu_ps(src + k), gain)));
+    }
+    for (; k < n; ++k) out[k] += src[k] * (base + (left - (float)k) * step);
+}
+
+__attribute__((target("avx2")))
+static void mix_ramp_avx2(float* out, const float* src, float base, float left, float step, uint32_t n) {
+    __m256 b = _mm256_set1_ps(base);
+    __m256 s = _mm256_set1_ps(step);
+    __m256 lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    uint32_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m256 gain = _mm256_add_ps(b, _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(left - (float)k), lane), s));
+        _mm256_storeu_ps(out + k, _mm256_add_ps(_mm256_loadu_ps(out + k), _mm256_mul_ps(_mm256_loadu_ps(src + k), gain)));
+    }
+    if (k + 4 <= n) {
+        __m128 gain = _mm_add_ps(_mm256_castps256_ps128(b),
+                                 _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(left - (float)k), _mm256_castps256_ps128(lane)),
+                                            _mm256_castps256_ps128(s)));
+        _mm_storeu_ps(out + k, _mm_add_ps(_mm_loadu_ps(out + k), _mm_mul_ps(_mm_loadu_ps(src + k), gain)));
+        k += 4;
+    }
+    for (; k < n; ++k) out[k] += src[k] * (base + (left - (float)k) * step);
+}
+
+// 8 amostras int16 -> 2 x 4 floats (extensão de sinal sem SSE4.1)
+__attribute__((target("sse2")))
+static inline void load8_i16_sse2(const int16_t* src, __m128& lo, __m128& hi) {
+    __m128i v = _mm_loadu_si128((const __m128i*)src);
+    lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+    hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+}
+
+__attribute__((target("sse2")))
+static void mix_mono16_sse(float* out, const int16_t* src, float gain, uint32_t n) {
+    __m128 g = _mm_set1_ps(gain);
+    uint32_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m128 lo, hi;
+        load8_i16_sse2(src + k, lo, hi);
+        _mm_storeu_ps(out + k, _mm_add_ps(_mm_loadu_ps(out + k), _mm_mul_ps(lo, g)));
+        _mm_storeu_ps(out + k + 4, _mm_add_ps(_mm_loadu_ps(out + k + 4), _mm_mul_ps(hi, g)));
+    }
+    for (; k < n; ++k) out[k] += (float)src[k] * gain;
+}
+
+__attribute__((target("sse2")))
+static void mix_stereo16_sse(float* outL, float* outR, const int16_t* srcL, const int16_t* srcR,
+                             float gain, uint32_t n) {
+    __m128 g = _mm_set1_ps(gain);
+    uint32_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m128 lo, hi;
+        load8_i16_sse2(srcL + k, lo, hi);
+        _mm_storeu_ps(outL + k, _mm_add_ps(_mm_loadu_ps(outL + k), _mm_mul_ps(lo, g)));
+        _mm_storeu_ps(outL + k + 4, _mm_add_ps(_mm_loadu_ps(outL + k + 4), _mm_mul_ps(hi, g)));
+        load8_i16_sse2(srcR + k, lo, hi);
+        _mm_storeu_ps(outR + k, _mm_add_ps(_mm_loadu_ps(outR + k), _mm_mul_ps(lo, g)));
+        _mm_storeu_ps(outR + k + 4, _mm_add_ps(_mm_loadu_ps(outR + k + 4), _mm_mul_ps(hi, g)));
+    }
+    for (; k < n; ++k) {
+        outL[k] += (float)srcL[k] * gain;
+        outR[k] += (float)srcR[k] * gain;
+    }
+}
+
+__attribute__((target("sse")))
+static void mix_mono_sse(float* out, const float* src, float gain, uint32_t n) {
+    __m128 g = _mm_set1_ps(gain);
+    uint32_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m128 a = _mm_add_ps(_mm_loadu_ps(out + k), _mm_mul_ps(_mm_loadu_ps(src + k), g));
+        __m128 b = _mm_add_ps(_mm_loadu_ps(out + k + 4), _mm_mul_ps(_mm_loadu_ps(src + k + 4), g));
+        _mm_storeu_ps(out + k, a);
+        _mm_storeu_ps(out + k + 4, b);
+    }
+    if (k + 4 <= n) {
+        _mm_storeu_ps(out + k, _mm_add_ps(_mm_loadu_ps(out + k), _mm_mul_ps(_mm_loadu_ps(src + k), g)));
+        k += 4;
+    }
+    for (; k < n; ++k) out[k] += src[k] * gain;
+}
+
+__attribute__((target("sse")))
+static void mix_stereo_sse(float* outL, float* outR, const float* srcL, const float* srcR,
+                           float gain, uint32_t n) {
+    __m128 g = _mm_set1_ps(gain);
+    uint32_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m128 l = _mm_add_ps(_mm_loadu_ps(outL + k), _mm_mul_ps(_mm_loadu_ps(srcL + k), g));
+        __m128 r = _mm_add_ps(_mm_loadu_ps(outR + k), _mm_mul_ps(_mm_loadu_ps(srcR + k), g));
+        _mm_storeu_ps(outL + k, l);
+        _mm_storeu_ps(outR + k, r);
+    }
+    for (; k < n; ++k) {
+        outL[k] += srcL[k] * gain;
+        outR[k] += srcR[k] * gain;
+    }
+}
+
+__attribute__((target("avx2")))
+static void mix_mono_avx2(float* out, const float* src, float gain, uint32_t n) {
+    __m256 g = _mm256_set1_ps(gain);
+    uint32_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m256 a = _mm256_add_ps(_mm256_loadu_ps(out + k), _mm256_mul_ps(_mm256_loadu_ps(src + k), g));
+        __m256 b = _mm256_add_ps(_mm256_loadu_ps(out + k + 8), _mm256_mul_ps(_mm256_loadu_ps(src + k + 8), g));
+        _mm256_storeu_ps(out + k, a);
+        _mm256_storeu_ps(out + k + 8, b);
+    }
+    if (k + 8 <= n) {
+        _mm256_storeu_ps(out + k, _mm256_add_ps(_mm256_loadu_ps(out + k), _mm256_mul_ps(_mm256_loadu_ps(src + k), g)));
+        k += 8;
+    }
+    if (k + 4 <= n) {
+        __m128 a = _mm_add_ps(_mm_loadu_ps(out + k), _mm_mul_ps(_mm_loadu_ps(src + k), _mm256_castps256_ps128(g)));
+        _mm_storeu_ps(out + k, a);
+        k += 4;
+    }
+    for (; k < n; ++k) out[k] += src[k] * gain;
+}
+
+__attribute__((target("avx2")))
+static void mix_stereo_avx2(float* outL, float* outR, const float* srcL, const float* srcR,
+                            float gain, uint32_t n) {
+    __m256 g = _mm256_set1_ps(gain);
+    uint32_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m256 l = _mm256_add_ps(_mm256_loadu_ps(outL + k), _mm256_mul_ps(_mm256_loadu_ps(srcL + k), g));
+        __m256 r = _mm256_add_ps(_mm256_loadu_ps(outR + k), _mm256_mul_ps(_mm256_loadu_ps(srcR + k), g));
+        _mm256_storeu_ps(outL + k, l);
+        _mm256_storeu_ps(outR + k, r);
+    }
+    if (k + 4 <= n) {
+        __m128 g4 = _mm256_castps256_ps128(g);
+        _mm_storeu_ps(outL + k, _mm_add_ps(_mm_loadu_ps(outL + k), _mm_mul_ps(_mm_loadu_ps(srcL + k), g4)));
+        _mm_storeu_ps(outR + k, _mm_add_ps(_mm_loadu_ps(outR + k), _mm_mul_ps(_mm_loadu_ps(srcR + k), g4)));
+        k += 4;
+    }
+    for (; k < n; ++k) {
+        outL[k] += srcL[k] * gain;
+        outR[k] += srcR[k] * gain;
+    }
+}
+
+__attribute__((target("avx2")))
+static void mix_mono16_avx2(float* out, const int16_t* src, float gain, uint32_t n) {
+    __m256 g = _mm256_set1_ps(gain);
+    uint32_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + k));
+        __m256 a = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(v)));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1)));
+        _mm256_storeu_ps(out + k, _mm256_add_ps(_mm256_loadu_ps(out + k), _mm256_mul_ps(a, g)));
+        _mm256_storeu_ps(out + k + 8, _mm256_add_ps(_mm256_loadu_ps(out + k + 8), _mm256_mul_ps(b, g)));
+    }
+    if (k + 8 <= n) {
+        __m256 a = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + k))));
+        _mm256_storeu_ps(out + k, _mm256_add_ps(_mm256_loadu_ps(out + k), _mm256_mul_ps(a, g)));
+        k += 8;
+    }
+    for (; k < n; ++k) out[k] += (float)src[k] * gain;
+}
+
+__attribute__((target("avx2")))
+static void mix_stereo16_avx2(float* outL, float* outR, const int16_t* srcL, const int16_t* srcR,
+                              float gain, uint32_t n) {
+    __m256 g = _mm256_set1_ps(gain);
+    uint32_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m256 l = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(srcL + k))));
+        __m256 r = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(srcR + k))));
+        _mm256_storeu_ps(outL + k, _mm256_add_ps(_mm256_loadu_ps(outL + k), _mm256_mul_ps(l, g)));
+        _mm256_storeu_ps(outR + k, _mm256_add_ps(_mm256_loadu_ps(outR + k), _mm256_mul_ps(r, g)));
+    }
+    for (; k < n; ++k) {
+        outL[k] += (float)srcL[k] * gain;
+        outR[k] += (float)srcR[k] * gain;
+    }
+}
+#endif
+
+static const MixKernels MIX_SCALAR = { "escalar", mix_mono_scalar, mix_stereo_scalar,
+                                        mix_mono16_scalar, mix_stereo16_scalar, mix_ramp_scalar };
+#ifdef MIX_HAVE_X86
+static const MixKernels MIX_SSE = { "SSE", mix_mono_sse, mix_stereo_sse, mix_mono16_sse, mix_stereo16_sse,
+                                    mix_ramp_sse };
+static const MixKernels MIX_AVX2 = { "AVX2", mix_mono_avx2, mix_stereo_avx2, mix_mono16_avx2, mix_stereo16_avx2,
+                                     mix_ramp_avx2 };
+#endif
+
+#define MIX_CAL_CALLS 512   // chamadas por rodada da medição dos kernels
+#define MIX_CAL_ROUNDS 7    // rodadas (vale a menor, descarta interrupções)
+#define MIX_CAL_SPAN 128    // trechos de 1 a MIX_CAL_SPAN frames
+
+// Mede os kernels candidatos (ns por frame) em trechos curtos de tamanho
+// variado, mono e estéreo alternados, como os do render_voices com blocos
+// pequenos e vozes cortadas por eventos; os dados cabem no cache. Todas as
+// variantes produzem a mesma saída, então a escolha não muda o áudio.
+static const MixKernels* calibrate_mix_kernels(const MixKernels* const* cands, int n_cands, double* ns) {
+    std::vector<float> src(2 * MIX_CAL_SPAN + 8, 0.25f), bus(2 * MIX_CAL_SPAN + 8, 0.0f);
+    std::vector<uint32_t> span(MIX_CAL_CALLS), offset(MIX_CAL_CALLS);
+    uint32_t rng = 1;
+    uint64_t frames = 0;
+    for (int i = 0; i < MIX_CAL_CALLS; ++i) {
+        rng = rng * 1664525u + 1013904223u;
+        span[i] = 1 + (rng >> 8) % MIX_CAL_SPAN;
+        offset[i] = (rng >> 20) % 8;  // alinhamentos variados
+        frames += span[i];
+    }
+
+    for (int c = 0; c < n_cands; ++c) ns[c] = 1e30;
+    for (int r = 0; r < MIX_CAL_ROUNDS; ++r) {
+        for (int c = 0; c < n_cands; ++c) {
+            const MixKernels* k = cands[c];
+            auto t0 = std::chrono::steady_clock::now();
+            for (int i = 0; i < MIX_CAL_CALLS; ++i) {
+                float* out = &bus[offset[i]];
+                const float* in = &src[offset[MIX_CAL_CALLS - 1 - i]];
+                if (i & 1) k->mono(out, in, 0.5f, span[i]);
+                else k->stereo(out, out + MIX_CAL_SPAN, in, in + MIX_CAL_SPAN, 0.5f, span[i]);
+            }
+            double dt = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+            ns[c] = std::min(ns[c], dt / frames);
+        }
+    }
+    volatile float sink = bus[0];  // a mixagem não pode ser descartada
+    (void)sink;
+
+    int best = 0;
+    for (int c = 1; c < n_cands; ++c) {
+        if (ns[c] < ns[best]) best = c;
+    }
+    return cands[best];
+}
+
+// Os kernels mais rápidos entre os suportados pela CPU, medidos uma vez por
+// processo: com blocos pequenos o custo fixo de cada chamada pode anular a
+// largura maior do AVX2, então a largura sozinha não decide
+static const MixKernels* measured_mix_kernels() {
+    static const MixKernels* const measured = []() {
+        const MixKernels* cands[3] = { &MIX_SCALAR };
+        int n = 1;
+#ifdef MIX_HAVE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) cands[n++] = &MIX_SSE;
+        if (__builtin_cpu_supports("avx2")) cands[n++] = &MIX_AVX2;
+#endif
+        double ns[3];
+        const MixKernels* pick = calibrate_mix_kernels(cands, n, ns);
+        char line[128] = "";
+        for (int c = 0; c < n; ++c) {
+            size_t used = strlen(line);
+            snprintf(line + used, sizeof(line) - used, "%s%s %.2f", c ? ", " : "", cands[c]->name, ns[c]);
+        }
+        fprintf(stderr, "MyDrumKit: Kernels de mixagem medidos (ns/frame): %s\n", line);
+        return pick;
+    }();
+    return measured;
+}
+
+// Escolhe os kernels de mixagem. `force` (MYDRUMKIT_SIMD) pode pedir
+// "scalar", "sse" ou "avx2"; sem ele, ou com uma variante não suportada,
+// vale a medição.
+static const MixKernels* select_mix_kernels(const char* force) {
+    if (!force || !*force) return measured_mix_kernels();
+
+    if (!strcmp(force, "scalar")) return &MIX_SCALAR;
+#ifdef MIX_HAVE_X86
+    __builtin_cpu_init();
+    if (!strcmp(force, "sse") && __builtin_cpu_supports("sse2")) return &MIX_SSE;
+    if (!strcmp(force, "avx2") && __builtin_cpu_supports("avx2")) return &MIX_AVX2;
+#endif
+    const MixKernels* best = measured_mix_kernels();
+    fprintf(stderr, "MyDrumKit: AVISO - MYDRUMKIT_SIMD=%s não suportado, usando %s\n", force, best->name);
+    return best;
+}
+
+// Round Robin Group - grupo de samples para uma nota
+//
+// Os samples são visões imutáveis compartilhadas (ver SampleStore): notas que
+// usam o mesmo arquivo, e outras instâncias do plugin, apontam para os mesmos dados.
+//
+// O grupo é preenchido em segundo plano: `samples` tem um slot por arquivo,
+// reservado no registro (na ordem do kit), e cada thread de carga escreve só
+// os seus slots. Quem carrega o último arquivo remove os slots que falharam
+// e publica `ready`; a thread de áudio só lê `samples` depois disso
+// (acquire/release). Assim cada nota fica tocável assim que os seus
+// arquivos terminam, com a ordem RR do kit.
+//
+// Camadas de velocity: `samples` guarda todas as camadas em sequência e cada
+// Layer é um trecho dele, com o seu próprio round robin. A camada e o ganho de
+// cada velocity vêm de `zones`, calculada na leitura do kit; o NOTE ON só
+// consulta a tabela.
+struct Layer {
+    uint32_t first;       // primeiro slot da camada em RRGroup::samples
+    uint32_t count;       // variações RR da camada
+    uint32_t current_rr;  // índice atual do round robin
+    int min_vel;          // menor velocity que toca a camada (kit.txt)
+};
+
+// Entrada da tabela de velocity: camada e ganho da voz e, na faixa de
+// crossfade, a camada vizinha tocada junto (blend_gain 0 = nenhuma)
+struct VelocityZone {
+    uint8_t layer;
+    uint8_t blend;
+    float gain;
+    float blend_gain;
+};
+
+struct RRGroup {
+    std::vector<std::shared_ptr<const Sample>> samples;
+    std::vector<Layer> layers;  // camadas de velocity, da mais fraca à mais forte
+    VelocityZone zones[128];    // velocity -> camada(s) e ganho
+    int xfade;                // largura do crossfade entre camadas (em velocities; 0 = nenhum)
+    int note;                 // nota MIDI
+    int output;               // saída de áudio (base)
+    bool stereo;              // samples estéreo em output e output + 1
+    std::vector<std::pair<int, float>> bleed;  // envios extras: saída e ganho linear (kit.txt)
+    int bus;                  // barramento do kit para o canal L (ou mono)
+    int busR;                 // barramento do canal R (grupos estéreo)
+    int chokeGroup;           // grupo de choke das vozes desta nota (0 = nenhum)
+    uint32_t chokeMask;       // grupos de choke cortados por esta nota (bit g = grupo g)
+    std::atomic<uint32_t> pending_files;  // slots ainda não preenchidos
+    std::atomic<bool> ready;  // grupo pronto para tocar
+
+    RRGroup() : xfade(0), note(0), output(0), stereo(false), bus(0), busR(0), chokeGroup(0), chokeMask(0), pending_files(0),
+                ready(false) {
+        layers.push_back({0, 0, 0, 1});
+    }
+
+    const Sample* getNextSample(uint32_t layer) {
+        Layer& l = layers[layer];
+        if (l.count == 0) return nullptr;
+        const Sample* s = samples[l.first + l.current_rr].get();
+        if (++l.current_rr == l.count) l.current_rr = 0;
+        return s;
+    }
+
+    // Tabela de velocity: ganho (vel / 127)^2 em todas as camadas; no
+    // crossfade, a camada de cada lado da fronteira recebe a sua fração
+    // (linear) do ganho. A faixa é limitada pela camada mais estreita.
+    void build_zones() {
+        int width = xfade;
+        for (size_t i = 0; i < layers.size(); ++i) {
+            int top = i + 1 < layers.size() ? layers[i + 1].min_vel : 128;
+            width = std::min(width, top - std::max(layers[i].min_vel, 1));
+        }
+        int half = width / 2;
+
+        uint32_t layer = 0;
+        for (int vel = 0; vel < 128; ++vel) {
+            while (layer + 1 < layers.size() && vel >= layers[layer + 1].min_vel) ++layer;
+            float v_norm = (float)vel / 127.0f;
+            VelocityZone& z = zones[vel];
+            z.layer = (uint8_t)layer;
+            z.blend = (uint8_t)layer;
+            z.gain = v_norm * v_norm;
+            z.blend_gain = 0.0f;
+            if (width <= 0) continue;
+
+            // Fronteira acima (com a próxima camada) ou abaixo (com a anterior)
+            int edge = -1;
+            uint32_t other = layer;
+            if (layer + 1 < layers.size() && vel >= layers[layer + 1].min_vel - half) {
+                edge = layers[layer + 1].min_vel;
+                other = layer + 1;
+            } else if (layer > 0 && vel < layers[layer].min_vel + (width - half)) {
+                edge = layers[layer].min_vel;
+                other = layer - 1;
+            }
+            if (edge < 0) continue;
+            float upper = ((float)(vel - (edge - half)) + 0.5f) / (float)width;  // peso da camada de cima
+            float own = other > layer ? 1.0f - upper : upper;
+            z.blend = (uint8_t)other;
+            z.blend_gain = z.gain * (1.0f - own);
+            z.gain *= own;
+        }
+    }
+
+    // Remove os slots dos arquivos que falharam, camada a camada. Uma camada
+    // que ficou vazia toca os samples da vizinha mais próxima (a de baixo, se houver).
+    void compact() {
+        uint32_t out = 0;
+        for (Layer& l : layers) {
+            uint32_t first = out;
+            for (uint32_t i = l.first; i < l.first + l.count; ++i) {
+                if (samples[i]) samples[out++] = std::move(samples[i]);
+            }
+            l.first = first;
+            l.count = out - first;
+        }
+        samples.resize(out);
+        if (samples.empty()) return;
+        for (size_t i = 0; i < layers.size(); ++i) {
+            if (layers[i].count) continue;
+            for (size_t d = 1; d < layers.size(); ++d) {
+                const Layer* n = i >= d && layers[i - d].count ? &layers[i - d]
+                               : i + d < layers.size() && layers[i + d].count ? &layers[i + d] : nullptr;
+                if (n) {
+                    layers[i].first = n->first;
+                    layers[i].count = n->count;
+                    break;
+                }
+            }
+        }
+    }
+};
+
+// Estrutura de uma voz ativa
+struct Voice {
+    const Sample* sample;
+    uint32_t pos;
+    uint32_t length;
+    int bus;          // barramento do canal L (ou mono), já com o banco do kit
+    int busR;         // barramento do canal R
+    float velocity;   // 0.0 - 1.0
+    int chokeGroup;   // id do grupo de choke desta voz (0 = nenhum)
+    uint64_t serial;  // ordem de disparo (menor = mais antiga)
+    int chokePrev;    // slot anterior na lista do grupo de choke (-1 = nenhum)
+    int chokeNext;    // próximo slot na lista do grupo de choke (-1 = nenhum)
+    uint32_t fade_len;   // duração da rampa de release (0 = voz tocando normalmente)
+    uint32_t fade_left;  // frames restantes da rampa
+    bool streamed;    // o final do sample vem do Streamer
+    bool stereo;      // mixada em bus e busR (kernel estéreo)
+
+    Voice() : sample(nullptr), pos(0), length(0), bus(0), busR(0), velocity(1.0f), chokeGroup(0),
+              serial(0), chokePrev(-1), chokeNext(-1), fade_len(0), fade_left(0), streamed(false), stereo(false) {}
+};
+
+// Pool de vozes com capacidade fixa, alocado no instantiate.
+//
+// Nenhuma operação aloca memória: os slots não se movem, `active` é uma lista
+// densa de slots em uso (remoção por swap com o último), `free_slots` é uma
+// pilha de slots livres e cada grupo de choke mantém uma lista duplamente
+// ligada dos seus slots, para que o choke visite apenas as vozes do grupo.
+// `occupied` marca os grupos com vozes: um choke de grupos vazios é O(1).
+//
+// A remoção por swap tira `active` da ordem de disparo; sort_active() a
+// restaura antes de cada mixagem, para que a soma das vozes em cada
+// barramento não dependa do histórico do pool (o render em segmentos sai
+// idêntico ao render contínuo).
+//
+// Choke e roubo não cortam a voz: ela sai do grupo e faz uma rampa de
+// release de RELEASE_MS (ver render_voices). Até `max_playing` vozes tocam
+// normalmente; os slots extras acomodam as vozes em release.
+struct VoicePool {
+    std::vector<Voice> slots;
+    std::vector<int> active;      // slots em uso (ver sort_active)
+    std::vector<int> active_pos;  // posição de cada slot em `active` (-1 = livre)
+    std::vector<int> free_slots;  // pilha de slots livres
+    int chokeHead[MAX_CHOKE_GROUPS];
+    uint32_t occupied;            // bit g: o grupo de choke g tem vozes
+    int max_playing;              // vozes fora de release antes de roubar
+    int releasing;                // vozes em rampa de release
+    uint32_t release_frames;      // duração da rampa (0 = corte seco)
+    uint64_t next_serial;
+    bool unordered;               // `active` saiu da ordem de disparo
+    Streamer* streamer;           // nullptr fora do modo streaming
+
+    // Contadores de telemetria: escritos só pela thread de áudio, legíveis de qualquer thread
+    std::atomic<uint64_t> steals;  // vozes roubadas com o pool cheio
+    std::atomic<uint64_t> chokes;  // vozes cortadas por choke
+    std::atomic<uint64_t> early_frames;  // frames não mixados por vozes encerradas antes (velocity baixa)
+
+    VoicePool() : occupied(0), max_playing(0), releasing(0), release_frames(0), next_serial(0), unordered(false), streamer(nullptr),
+                  steals(0), chokes(0), early_frames(0) {
+        for (int g = 0; g < MAX_CHOKE_GROUPS; ++g) chokeHead[g] = -1;
+    }
+
+    void init(int playing, int extra) {
+        int capacity = playing + extra;
+        max_playing = playing;
+        slots.assign(capacity, Voice());
+        active.clear();
+        active.reserve(capacity);
+        active_pos.assign(capacity, -1);
+        free_slots.clear();
+        free_slots.reserve(capacity);
+        for (int i = capacity - 1; i >= 0; --i) free_slots.push_back(i);
+    }
+
+    int capacity() const { return (int)slots.size(); }
+    int size() const { return (int)active.size(); }
+
+    // Escolhe a voz a ser roubada: a mais silenciosa (ganho x parte restante
+    // do sample), e entre iguais a mais antiga. Vozes já em release e o slot
+    // `keep` não contam. A varredura é limitada pela capacidade e só acontece
+    // com o pool cheio.
+    int pickVictim(int keep) const {
+        int victim = -1;
+        float best_level = 0.0f;
+        uint64_t best_serial = 0;
+        for (int slot : active) {
+            const Voice& v = slots[slot];
+            if (v.fade_len || slot == keep) continue;
+            float remaining = v.length ? (float)(v.length - v.pos) / (float)v.length : 0.0f;
+            float level = v.velocity * remaining;
+            if (victim < 0 || level < best_level ||
+                (level == best_level && v.serial < best_serial)) {
+                victim = slot;
+                best_level = level;
+                best_serial = v.serial;
+            }
+        }
+        return victim;
+    }
+
+    // Voz em release mais próxima do fim (para liberar um slot sem espera)
+    int pickFading() const {
+        int pick = -1;
+        for (int slot : active) {
+            const Voice& v = slots[slot];
+            if (v.fade_len && (pick < 0 || v.fade_left < slots[pick].fade_left)) pick = slot;
+        }
+        return pick;
+    }
+
+    // Reserva um slot para uma nova voz, roubando uma voz se o pool estiver
+    // cheio. `keep` (ou -1) é uma voz que não pode ser roubada: a outra
+    // camada do mesmo golpe no crossfade. Retorna -1 se nenhum slot vagar.
+    int start(int chokeGroup, int keep = -1) {
+        if (size() - releasing >= max_playing) {
+            int victim = pickVictim(keep);
+            if (victim >= 0) {
+                fade(victim);
+                steals.store(steals.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+        }
+        if (free_slots.empty()) {
+            // Todos os slots extras em release: encerra a rampa mais adiantada
+            int slot = pickFading();
+            if (slot < 0) slot = pickVictim(keep);
+            if (slot >= 0) release(slot);
+        }
+        if (free_slots.empty()) return -1;
+
+        int slot = free_slots.back();
+        free_slots.pop_back();
+        active_pos[slot] = (int)active.size();
+        active.push_back(slot);
+
+        Voice& v = slots[slot];
+        v = Voice();
+        v.serial = next_serial++;
+        v.chokeGroup = (chokeGroup > 0 && chokeGroup < MAX_CHOKE_GROUPS) ? chokeGroup : 0;
+        if (v.chokeGroup > 0) {
+            v.chokeNext = chokeHead[v.chokeGroup];
+            if (v.chokeNext >= 0) slots[v.chokeNext].chokePrev = slot;
+            chokeHead[v.chokeGroup] = slot;
+            occupied |= 1u << v.chokeGroup;
+        }
+        return slot;
+    }
+
+    // Tira a voz da lista do seu grupo de choke
+    void unlink(Voice& v) {
+        if (v.chokeGroup <= 0) return;
+        if (v.chokePrev >= 0) slots[v.chokePrev].chokeNext = v.chokeNext;
+        else chokeHead[v.chokeGroup] = v.chokeNext;
+        if (v.chokeNext >= 0) slots[v.chokeNext].chokePrev = v.chokePrev;
+        if (chokeHead[v.chokeGroup] < 0) occupied &= ~(1u << v.chokeGroup);
+        v.chokeGroup = 0;
+        v.chokePrev = v.chokeNext = -1;
+    }
+
+    // Inicia a rampa de release de uma voz (ou a libera, sem rampa configurada)
+    void fade(int slot) {
+        Voice& v = slots[slot];
+        if (v.fade_len) return;
+        if (release_frames == 0) {
+            release(slot);
+            return;
+        }
+        unlink(v);
+        v.fade_len = v.fade_left = release_frames;
+        ++releasing;
+    }
+
+    // Libera um slot em O(1)
+    void release(int slot) {
+        Voice& v = slots[slot];
+        unlink(v);
+        if (v.fade_len) --releasing;
+        if (v.streamed && streamer) streamer->stop(slot);
+        v.streamed = false;
+        v.sample = nullptr;
+        v.fade_len = v.fade_left = 0;
+
+        int pos = active_pos[slot];
+        int last = active.back();
+        active[pos] = last;
+        active_pos[last] = pos;
+        active.pop_back();
+        active_pos[slot] = -1;
+        if (last != slot) unordered = true;
+
+        free_slots.push_back(slot);
+    }
+
+    // Recoloca `active` na ordem de disparo (serial). Cada swap desloca uma
+    // voz só: a inserção percorre a lista quase ordenada uma vez.
+    void sort_active() {
+        if (!unordered) return;
+        for (int i = 1; i < (int)active.size(); ++i) {
+            int slot = active[i];
+            uint64_t serial = slots[slot].serial;
+            int j = i;
+            for (; j > 0 && slots[active[j - 1]].serial > serial; --j) {
+                active[j] = active[j - 1];
+                active_pos[active[j]] = j;
+            }
+            active[j] = slot;
+            active_pos[slot] = j;
+        }
+        unordered = false;
+    }
+
+    // Inicia o release de todas as vozes dos grupos em `mask` (bit g = grupo g)
+    void choke(uint32_t mask) {
+        for (uint32_t m = mask & occupied; m; m &= m - 1) {
+            int group = __builtin_ctz(m);
+            while (chokeHead[group] >= 0) {
+                fade(chokeHead[group]);  // sai da lista do grupo
+                chokes.store(chokes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+// Arquivo registrado no instantiate e carregado em segundo plano
+struct SampleRef {
+    int note;
+    std::string relpath;
+    bool stereo;
+    uint32_t slot;  // posição em RRGroup::samples (todas as camadas)
+};
+
+// Kit: grupos RR e tabela de notas lidos de um arquivo de definição.
+//
+// A thread de áudio toca um kit por vez (MyDrumKit::kit). Na troca de kit o
+// novo é lido e carregado inteiro fora dela e entregue em `next_kit`; o run()
+// troca os ponteiros entre dois blocos. O kit antigo fica vivo enquanto houver
+// vozes tocando os seus samples e é liberado fora da thread de áudio.
+//
+// Roteamento: as vozes não escrevem nas saídas, e sim em barramentos
+// internos, um por canal de saída e conjunto de bleed (grupos com a mesma
+// saída e o mesmo bleed compartilham o barramento). `sends` é a matriz
+// esparsa barramento -> saída, aplicada uma vez por trecho sobre os
+// barramentos com som: o custo do bleed não cresce com o número de vozes.
+// Cada kit usa um banco de MAX_BUSES barramentos (`bus_base`), alternado a
+// cada troca para as vozes do kit antigo manterem o seu roteamento.
+struct BusSend {
+    int bus;       // barramento do kit
+    int output;    // saída
+    float gain;    // ganho linear
+    bool bleed;    // envio de bleed (escalado também pela porta de bleed)
+};
+
+struct Kit {
+    std::vector<std::unique_ptr<RRGroup>> groups;  // grupos do kit, na ordem do arquivo de kit
+    RRGroup* note_table[128];          // nota MIDI -> grupo (nullptr = nota sem samples)
+    std::string path;                  // arquivo de definição do kit
+    std::string dir;                   // diretório do kit (base dos caminhos dos samples)
+    std::vector<SampleRef> pending;    // arquivos a carregar, em ordem de registro
+    std::vector<BusSend> sends;        // matriz de saídas (entradas não nulas)
+    int bus_base;                      // thread de áudio: primeiro barramento do banco do kit
+
+    Kit() : bus_base(0) {
+        for (int n = 0; n < 128; ++n) note_table[n] = nullptr;
+    }
+};
+
+// Mensagens enviadas ao worker
+enum WorkType : uint32_t {
+    WORK_LOAD_SAMPLES = 1,  // carrega os samples de `kit` (kit inicial)
+    WORK_SET_KIT = 2,       // troca de kit (patch:Set); seguido do caminho, terminado em '\0'
+    WORK_RESTORE_KIT = 3,   // troca para o kit pedido pelo restore(); `kit` se ela falhar
+    WORK_FREE_KIT = 4       // libera `kit` (kit antigo sem vozes)
+};
+
+struct WorkMessage {
+    uint32_t type;
+    Kit* kit;
+};
+
+// Telemetria do motor, publicada na porta atom `telemetry` como um objeto
+// MYDRUMKIT_URI#Telemetry. Contadores totais (frames, roubos, chokes,
+// underruns) são cumulativos; pico de polifonia e custo do run() valem para
+// o intervalo desde a publicação anterior, assim como as saídas com som.
+//
+// Escrita só pela thread de áudio, sem alocação nem chamadas de sistema
+// (apenas a leitura do relógio monotônico, via vDSO). Os totais são
+// atômicos para serem lidos sem lock fora dela.
+struct Telemetry {
+    LV2_URID type, voices, peak_voices, steals, chokes, frames, dsp_load, dsp_load_peak, underruns, active_outputs;
+    LV2_Atom_Forge forge;
+    uint32_t period_frames;          // intervalo de publicação (0 = todo bloco)
+
+    std::atomic<uint64_t> total_frames;
+    std::atomic<uint32_t> max_voices;    // pico de polifonia desde o instantiate
+    std::atomic<float> worst_load;       // pior bloco: custo / prazo
+
+    // Intervalo em andamento
+    uint32_t interval_frames;
+    uint32_t interval_peak;
+    uint32_t interval_active;        // saídas com som no intervalo (bit i = saída i + 1)
+    double interval_cost;            // soma dos custos do run() (s)
+    double interval_deadline;        // soma dos prazos dos blocos (s)
+    float interval_worst;
+
+    Telemetry() : type(0), voices(0), peak_voices(0), steals(0), chokes(0), frames(0), dsp_load(0),
+                  dsp_load_peak(0), underruns(0), active_outputs(0), period_frames(0), total_frames(0), max_voices(0),
+                  worst_load(0.0f), interval_frames(0), interval_peak(0), interval_active(0), interval_cost(0.0),
+                  interval_deadline(0.0), interval_worst(0.0f) {
+        std::memset(&forge, 0, sizeof(forge));
+    }
+
+    void map_uris(LV2_URID_Map* map) {
+        type = map->map(map->handle, MYDRUMKIT_URI "#Telemetry");
+        voices = map->map(map->handle, MYDRUMKIT_URI "#voices");
+        peak_voices = map->map(map->handle, MYDRUMKIT_URI "#peakVoices");
+        steals = map->map(map->handle, MYDRUMKIT_URI "#steals");
+        chokes = map->map(map->handle, MYDRUMKIT_URI "#chokes");
+        frames = map->map(map->handle, MYDRUMKIT_URI "#frames");
+        dsp_load = map->map(map->handle, MYDRUMKIT_URI "#dspLoad");
+        dsp_load_peak = map->map(map->handle, MYDRUMKIT_URI "#dspLoadPeak");
+        underruns = map->map(map->handle, MYDRUMKIT_URI "#underruns");
+        active_outputs = map->map(map->handle, MYDRUMKIT_URI "#activeOutputs");
+        lv2_atom_forge_init(&forge, map);
+    }
+
+    void note_voices(uint32_t n) {
+        if (n > interval_peak) interval_peak = n;
+    }
+};
+
+// Nível lido de uma porta de controle em dB, com rampa linear a cada mudança.
+// A primeira leitura vale de imediato (sem rampa a partir do padrão).
+struct GainSmoother {
+    float gain;     // ganho linear no início do próximo trecho
+    float target;   // ganho pedido pela porta
+    float step;     // variação por frame durante a rampa
+    uint32_t left;  // frames restantes da rampa
+    float db;       // último valor lido (NaN = nenhum)
+
+    GainSmoother() : gain(1.0f), target(1.0f), step(0.0f), left(0), db(NAN) {}
+
+    void set_db(float value, uint32_t ramp_frames) {
+        if (value == db || value != value) return;
+        bool first = db != db;
+        db = value;
+        target = value <= GAIN_MIN_DB ? 0.0f : powf(10.0f, value / 20.0f);
+        if (first || ramp_frames == 0) {
+            gain = target;
+            left = 0;
+        } else {
+            left = ramp_frames;
+            step = (target - gain) / (float)ramp_frames;
+        }
+    }
+
+    // Avança n frames e retorna o ganho ao fim deles
+    float advance(uint32_t n) {
+        if (left == 0) return gain;
+        if (n >= left) {
+            gain = target;
+            left = 0;
+        } else {
+            gain += step * (float)n;
+            left -= n;
+        }
+        return gain;
+    }
+};
+
+// Estrutura principal do plugin
+struct MyDrumKit {
+    Kit* kit;                          // kit em uso pela thread de áudio
+    VoicePool voices;
+    Streamer streamer;
+    const MixKernels* mix;             // kernels de mixagem para esta CPU
+    std::vector<float> fade_bufL;      // vozes em release: trecho antes da rampa (RELEASE_MS)
+    std::vector<float> fade_bufR;
+    uint32_t stream_ms;                // início residente por sample no modo streaming (0 = desligado)
+    uint32_t sample_rate;              // taxa do host
+    bool use_kit_cache;                // cache de kit pré-decodificado (MYDRUMKIT_CACHE)
+    SampleFormat storage;              // formato dos samples na memória (MYDRUMKIT_STORAGE)
+    float trim_db;                     // limiar do corte de silêncio, dBFS (MYDRUMKIT_TRIM_DB; 0 = desligado)
+    bool huge_pages;                   // arena de samples em huge pages (MYDRUMKIT_MEMORY)
+    bool lock_memory;                  // mlock da arena e do cache de kit (MYDRUMKIT_MEMORY)
+    float* outputs[NUM_OUTPUTS];
+    float* progress;                   // porta de controle: carregamento (%)
+    float* activity;                   // porta de controle: saídas com som no bloco (opcional)
+    uint32_t out_active;               // saídas escritas no bloco em andamento (bit i = saída i)
+    uint32_t out_zeroed[NUM_OUTPUTS];  // frames do buffer de saída que já estão zerados
+    bool sparse_outputs;               // não reescreve saídas em silêncio (MYDRUMKIT_SPARSE)
+
+    // Matriz de saídas (ver Kit)
+    std::vector<float> buses;          // 2 bancos de MAX_BUSES barramentos de BUS_FRAMES frames
+    uint64_t bus_active;               // barramentos com som no trecho em andamento
+    const float* gain_ports[NUM_OUTPUTS];  // portas de nível das saídas (dB, opcionais)
+    const float* bleed_port;           // porta de nível do bleed (dB, opcional)
+    GainSmoother out_gain[NUM_OUTPUTS];
+    GainSmoother bleed_gain;
+    uint32_t smooth_frames;            // GAIN_SMOOTH_MS em frames
+
+    LV2_Atom_Sequence* telemetry_out;  // porta atom de telemetria (opcional)
+    Telemetry telemetry;
+    const LV2_Atom_Sequence* midi_in;
+    LV2_URID midi_event_urid;
+
+    // Propriedade <#kit> (patch:Set/patch:Get na entrada MIDI, LV2 State)
+    LV2_URID atom_object_urid;
+    LV2_URID atom_path_urid;
+    LV2_URID atom_urid_urid;
+    LV2_URID patch_set_urid;
+    LV2_URID patch_get_urid;
+    LV2_URID patch_property_urid;
+    LV2_URID patch_value_urid;
+    LV2_URID kit_urid;
+    bool notify_kit;                   // thread de áudio: publicar o kit atual na porta atom
+
+    // Carregamento em segundo plano
+    LV2_Worker_Schedule* schedule;     // worker do host (nullptr = thread própria)
+    bool load_scheduled;               // thread de áudio: carga já agendada
+    std::thread loader;                // usada apenas sem worker do host
+    std::atomic<bool> loading;         // work() ou thread de carga usando `self` (ver cleanup)
+    std::atomic<bool> abort_load;
+    std::atomic<bool> load_done;       // carga terminada (incluindo a geração do cache de kit)
+    std::atomic<uint32_t> files_loaded;
+    std::atomic<uint32_t> files_total; // arquivos da carga em andamento
+
+    // Troca de kit (ver Kit)
+    std::atomic<Kit*> next_kit;        // kit novo já carregado, à espera do run()
+    Kit* retired;                      // thread de áudio: kit antigo com vozes ainda tocando
+    uint64_t retired_serial;           // vozes com serial menor são do kit antigo
+    std::atomic<Kit*> garbage;         // kit antigo sem vozes, a liberar (sem worker do host)
+    std::mutex kit_mutex;
+    std::string kit_selected;          // kit escolhido, salvo no estado (protegido por kit_mutex)
+    std::string kit_requested;         // kit pedido pelo restore() (protegido por kit_mutex)
+    std::atomic<bool> restore_pending; // run(): agendar WORK_RESTORE_KIT no worker
+
+    // Construtor
+    MyDrumKit() : kit(nullptr), mix(&MIX_SCALAR), stream_ms(0), sample_rate(0), use_kit_cache(true), storage(SAMPLE_FLOAT), trim_db(-90.0f), huge_pages(false), lock_memory(false), progress(nullptr),
+                  activity(nullptr), out_active(0), sparse_outputs(false),
+                  bus_active(0), bleed_port(nullptr), smooth_frames(0), telemetry_out(nullptr), midi_in(nullptr), midi_event_urid(0),
+                  atom_object_urid(0), atom_path_urid(0), atom_urid_urid(0), patch_set_urid(0), patch_get_urid(0),
+                  patch_property_urid(0), patch_value_urid(0), kit_urid(0), notify_kit(false),
+                  schedule(nullptr), load_scheduled(false),
+                  loading(false), abort_load(false), load_done(false), files_loaded(0), files_total(0),
+                  next_kit(nullptr), retired(nullptr), retired_serial(0), garbage(nullptr), restore_pending(false) {
+        for (int i = 0; i < NUM_OUTPUTS; ++i) {
+            outputs[i] = nullptr;
+            out_zeroed[i] = 0;
+            gain_ports[i] = nullptr;
+        }
+        buses.assign(2 * MAX_BUSES * BUS_FRAMES, 0.0f);
+        voices.init(MAX_VOICES, MAX_RELEASE_VOICES);
+    }
+
+    // Os kits são liberados depois da thread leitora do streaming, que pode
+    // ainda apontar para os seus samples
+    ~MyDrumKit() {
+        streamer.shutdown();
+        delete kit;
+        delete retired;
+        delete next_kit.load();
+        delete garbage.load();
+    }
+
+    float* bus(int b) { return buses.data() + (size_t)b * BUS_FRAMES; }
+};
+
+// Função para converter caminhos: bundle_path + "/" + rel
+static std::string join_path(const char* bundle_path, const char* rel) {
+    if (!bundle_path || bundle_path[0] == '\0') return std::string(rel);
+    std::string bp(bundle_path);
+    if (bp.back() == '/')
+        return bp + rel;
+    else
+        return bp + "/" + rel;
+}
+
+// Carrega um WAV do bundle (mantém estéreo se for o caso)
+//
+// Com head_ms > 0 (modo streaming) apenas os primeiros head_ms milissegundos
+// ficam na memória; o restante é lido do disco pelo Streamer. Se
+// `target_rate` difere da taxa do arquivo, o sample é reamostrado e fica
+// inteiro na memória: o Streamer lê o WAV na taxa original, e os dados já
+// convertidos só podem vir do cache de kit.
+static Sample load_wav_from_bundle(const char* bundle_path, const char* relpath, bool force_stereo = false,
+                                   uint32_t head_ms = 0, uint32_t target_rate = 0) {
+    std::string full = join_path(bundle_path, relpath);
+    const std::string& path = full;
+    SF_INFO info{};
+    SNDFILE* file = sf_open(path.c_str(), SFM_READ, &info);
+
+    Sample s;
+    if (!file) {
+        fprintf(stderr, "MyDrumKit: Erro ao carregar %s: %s\n",
+                path.c_str(), sf_strerror(nullptr));
+        return s;
+    }
+
+    s.channels = info.channels;
+    s.sampleRate = info.samplerate;
+    sf_count_t frames = info.frames;
+
+    if (frames <= 0 || info.channels <= 0) {
+        fprintf(stderr, "MyDrumKit: Arquivo inválido %s\n", path.c_str());
+        sf_close(file);
+        return s;
+    }
+
+    std::shared_ptr<const Resampler> resampler;
+    if (target_rate && (uint32_t)info.samplerate != target_rate) {
+        resampler = get_resampler(info.samplerate, target_rate);
+        if (!resampler->valid()) {
+            fprintf(stderr, "MyDrumKit: AVISO - conversão %d -> %u Hz não suportada, %s tocará na taxa original\n",
+                    info.samplerate, target_rate, relpath);
+            resampler.reset();
+        }
+    }
+
+    // Parte residente: o sample inteiro, ou só o início no modo streaming
+    sf_count_t resident = frames;
+    if (head_ms > 0 && !resampler) {
+        resident = std::min(frames, (sf_count_t)head_ms * info.samplerate / 1000);
+    }
+
+    std::vector<float> tmp(resident * info.channels);
+    sf_count_t read = sf_readf_float(file, tmp.data(), resident);
+    sf_close(file);
+
+    if (read != resident) {
+        fprintf(stderr, "MyDrumKit: Leitura incompleta de %s\n", path.c_str());
+    }
+
+    s.frames = (uint32_t)frames;
+    s.path = path;
+    s.file_channels = info.channels;
+
+    // Se force_stereo está ativo E o arquivo é estéreo, mantém estéreo; senão converte para mono
+    s.is_stereo = force_stereo && info.channels >= 2;
+    s.channels = s.is_stereo ? 2 : 1;
+    allocate_sample(s, (uint32_t)resident);
+    convert_frames(tmp.data(), info.channels, s.is_stereo,
+                   (float*)s.dataL, (float*)s.dataR, resident);
+
+    if (resampler) {
+        Sample native = s;
+        s.frames = resampler->output_frames(native.frames);
+        s.sampleRate = (int)target_rate;
+        allocate_sample(s, s.frames);
+        resampler->process((const float*)native.dataL, native.frames, (float*)s.dataL);
+        if (s.is_stereo) resampler->process((const float*)native.dataR, native.frames, (float*)s.dataR);
+        frames = s.frames;
+        resident = s.frames;
+    }
+
+    const char* layout = s.is_stereo ? "ESTÉREO" : (info.channels == 1 ? "mono" : "-> mono");
+    if (s.streamed()) {
+        fprintf(stderr, "MyDrumKit: Carregado %s (%s, %d Hz, %lld frames, %lld residentes)\n",
+                relpath, layout, s.sampleRate, (long long)frames, (long long)resident);
+    } else if (!resampler) {
+        fprintf(stderr, "MyDrumKit: Carregado %s (%s, %d Hz, %lld frames)\n",
+                relpath, layout, s.sampleRate, (long long)frames);
+    } else {
+        fprintf(stderr, "MyDrumKit: Carregado %s (%s, %d -> %d Hz, %lld frames)\n",
+                relpath, layout, info.samplerate, s.sampleRate, (long long)frames);
+    }
+
+    return s;
+}
+
+// Cria um diretório e os seus pais (mkdir -p)
+static bool make_dirs(const std::string& dir) {
+    for (size_t i = 1; i <= dir.size(); ++i) {
+        if (i == dir.size() || dir[i] == '/') {
+            std::string part = dir.substr(0, i);
+            if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) return false;
+        }
+    }
+    return true;
+}
+
+// Hash FNV-1a de 64 bits
+static uint64_t fnv1a(const void* data, size_t n, uint64_t h = 1469598103934665603ULL) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Tamanho e data de modificação (ns) de um arquivo
+static bool file_identity(const std::string& path, struct stat& st, int64_t& mtime_ns) {
+    if (stat(path.c_str(), &st) != 0) return false;
+    mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+// Cache de kit pré-decodificado (arquivo binário mapeado com mmap)
+//
+// Formato: cabeçalho, tabela de entradas e os planos de áudio (float ou
+// int16, conforme MYDRUMKIT_STORAGE), já separados em L/R, convertidos para
+// a taxa do host e alinhados em KIT_CACHE_ALIGN bytes. É gerado ao final da
+// primeira carga (ou com `make cache`) e mapeado somente leitura nas
+// seguintes, de modo que o page cache do sistema é compartilhado entre
+// instâncias e processos. É descartado se a definição do kit, a taxa do
+// host ou algum WAV (tamanho/mtime) mudar.
+#define KIT_CACHE_MAGIC "MDKCACHE"
+#define KIT_CACHE_VERSION 5
+#define KIT_CACHE_ALIGN SAMPLE_ARENA_ALIGN
+#define KIT_CACHE_PATH_MAX 192
+
+struct KitCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sample_rate;   // taxa do host para a qual o cache foi gerado
+    uint32_t n_entries;
+    uint32_t format;        // SampleFormat dos planos
+    uint64_t kit_hash;      // hash da definição do kit (arquivos + estéreo)
+    uint64_t file_size;
+    float trim_db;          // limiar do corte de silêncio (0 = sem corte)
+    uint32_t reserved;
+};
+
+struct KitCacheEntry {
+    char relpath[KIT_CACHE_PATH_MAX];
+    uint64_t src_size;      // identidade do WAV de origem
+    int64_t src_mtime_ns;
+    uint64_t offsetL;       // em bytes, desde o início do arquivo
+    uint64_t offsetR;       // 0 se mono
+    uint32_t frames;
+    uint32_t sample_rate;
+    uint32_t file_channels;
+    uint32_t stereo;
+    float scale;            // SAMPLE_INT16: fator de conversão para float
+    uint32_t trimmed;       // frames de silêncio removidos
+    uint32_t level_end[TRIM_LEVELS];
+};
+
+// Arquivo de kit (sample + forma de carregamento) na ordem de registro
+struct KitCacheSource {
+    std::string relpath;
+    bool stereo;
+    std::shared_ptr<const Sample> sample;  // sample já carregado, se houver
+};
+
+// Hash da definição do kit: quais arquivos, em que ordem, estéreo ou mono
+static uint64_t kit_cache_hash(const std::vector<KitCacheSource>& sources) {
+    uint64_t h = fnv1a(KIT_CACHE_MAGIC, 8);
+    for (const KitCacheSource& src : sources) {
+        h = fnv1a(src.relpath.c_str(), src.relpath.size() + 1, h);
+        uint8_t stereo = src.stereo ? 1 : 0;
+        h = fnv1a(&stereo, 1, h);
+    }
+    return h;
+}
+
+// Caminho do arquivo de cache: MYDRUMKIT_CACHE_DIR, $XDG_CACHE_HOME/mydrumkit
+// ou ~/.cache/mydrumkit, com um nome por arquivo de kit, taxa de amostragem e formato
+static std::string kit_cache_path(const std::string& kit_path, uint32_t sample_rate, SampleFormat format) {
+    std::string dir;
+    if (const char* env = getenv("MYDRUMKIT_CACHE_DIR")) {
+        dir = env;
+    } else if (const char* xdg = getenv("XDG_CACHE_HOME")) {
+        dir = std::string(xdg) + "/mydrumkit";
+    } else if (const char* home = getenv("HOME")) {
+        dir = std::string(home) + "/.cache/mydrumkit";
+    }
+    if (dir.empty()) return std::string();
+
+    char real[PATH_MAX];
+    const char* kit = realpath(kit_path.c_str(), real) ? real : kit_path.c_str();
+    char name[64];
+    snprintf(name, sizeof(name), "kit-%016llx-%u%s.bin",
+             (unsigned long long)fnv1a(kit, strlen(kit)), sample_rate, format == SAMPLE_INT16 ? "-i16" : "");
+    return dir + "/" + name;
+}
+
+// Arquivo de cache mapeado na memória (somente leitura)
+class KitCacheMap : public std::enable_shared_from_this<KitCacheMap> {
+public:
+    ~KitCacheMap() {
+        if (base) {
+            munlock(base, size);
+            munmap((void*)base, size);
+        }
+    }
+
+    // Mapeia e valida o cache. Retorna nullptr se ausente ou desatualizado.
+    // `populate` carrega todas as páginas já no mapeamento (sem page faults no run()).
+    static std::shared_ptr<KitCacheMap> open(const std::string& path, uint32_t sample_rate, SampleFormat format,
+                                             float trim_db, const std::vector<KitCacheSource>& sources,
+                                             const std::string& bundle_path, bool populate) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(KitCacheHeader)) {
+            close(fd);
+            return nullptr;
+        }
+        void* mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED) return nullptr;
+
+        std::shared_ptr<KitCacheMap> map(new KitCacheMap((const uint8_t*)mem, st.st_size));
+        const char* why = map->validate(sample_rate, format, trim_db, sources, bundle_path);
+        if (why) {
+            fprintf(stderr, "MyDrumKit: Cache de kit desatualizado (%s): %s\n", why, path.c_str());
+            return nullptr;
+        }
+        return map;
+    }
+
+    // Trava o mapeamento na memória (MYDRUMKIT_MEMORY=mlock)
+    bool lock() const {
+        return mlock(base, size) == 0;
+    }
+
+    const KitCacheEntry* find(const char* relpath, bool stereo) const {
+        for (uint32_t i = 0; i < header()->n_entries; ++i) {
+            const KitCacheEntry& e = entries()[i];
+            if (!strcmp(e.relpath, relpath) && (e.stereo != 0) == stereo) return &e;
+        }
+        return nullptr;
+    }
+
+    // Sample apontando para os planos mapeados. No modo streaming, o início
+    // é copiado para memória própria e o restante é lido do mapeamento pela
+    // thread leitora.
+    Sample sample(const KitCacheEntry& e, uint32_t head_ms, const std::string& full_path,
+                  const std::shared_ptr<SampleArena>& arena = nullptr) const {
+        Sample s;
+        s.frames = e.frames;
+        s.sampleRate = e.sample_rate;
+        s.is_stereo = e.stereo != 0;
+        s.channels = s.is_stereo ? 2 : 1;
+        s.path = full_path;
+        s.file_channels = e.file_channels;
+        s.format = (SampleFormat)header()->format;
+        s.scale = e.scale;
+        s.trimmed = e.trimmed;
+        std::memcpy(s.level_end, e.level_end, sizeof(s.level_end));
+        s.srcL = base + e.offsetL;
+        s.srcR = s.is_stereo ? base + e.offsetR : nullptr;
+
+        uint32_t head = head_ms ? (uint32_t)std::min<uint64_t>(e.frames, (uint64_t)head_ms * e.sample_rate / 1000)
+                                : e.frames;
+        if (head < e.frames) {
+            allocate_sample(s, head, arena);
+            size_t bytes = head * sample_format_size(s.format);
+            std::memcpy((void*)s.dataL, s.srcL, bytes);
+            if (s.is_stereo) std::memcpy((void*)s.dataR, s.srcR, bytes);
+            // A memória própria guarda o início; o mapeamento precisa continuar vivo para o streaming
+            auto both = std::make_shared<std::pair<std::shared_ptr<const void>, std::shared_ptr<const KitCacheMap>>>(
+                s.storage, shared_from_this());
+            s.storage = both;
+        } else {
+            s.dataL = s.srcL;
+            s.dataR = s.srcR;
+            s.resident = e.frames;
+            s.storage = shared_from_this();
+        }
+        return s;
+    }
+
+    // Grava o cache a partir dos samples carregados (decodificando por completo
+    // os que estão só parcialmente residentes). Escreve em um arquivo temporário
+    // e renomeia, para que leitores nunca vejam um cache pela metade.
+    static bool write(const std::string& path, uint32_t sample_rate, SampleFormat format, float trim_db,
+                      const std::vector<KitCacheSource>& sources, const std::string& bundle_path) {
+        std::vector<KitCacheEntry> entries(sources.size());
+        std::vector<std::shared_ptr<const Sample>> full(sources.size());
+
+        uint64_t offset = align(sizeof(KitCacheHeader) + entries.size() * sizeof(KitCacheEntry));
+        for (size_t i = 0; i < sources.size(); ++i) {
+            const KitCacheSource& src = sources[i];
+            if (src.relpath.size() >= KIT_CACHE_PATH_MAX) return false;
+
+            std::shared_ptr<const Sample> s = src.sample;
+            if (!s || s->streamed()) {
+                Sample decoded = load_wav_from_bundle(bundle_path.c_str(), src.relpath.c_str(), src.stereo, 0, sample_rate);
+                trim_silence(decoded, trim_db);
+                s = std::make_shared<const Sample>(decoded);
+            }
+            if (!s->empty() && s->format != format) {
+                s = std::make_shared<const Sample>(encode_int16(*s));
+            }
+            struct stat st;
+            int64_t mtime_ns;
+            if (s->empty() || !file_identity(join_path(bundle_path.c_str(), src.relpath.c_str()), st, mtime_ns)) {
+                return false;
+            }
+            full[i] = s;
+
+            KitCacheEntry& e = entries[i];
+            std::memset(&e, 0, sizeof(e));
+            std::strcpy(e.relpath, src.relpath.c_str());
+            e.src_size = st.st_size;
+            e.src_mtime_ns = mtime_ns;
+            e.frames = s->frames;
+            e.sample_rate = s->sampleRate;
+            e.file_channels = s->file_channels;
+            e.stereo = s->is_stereo ? 1 : 0;
+            e.scale = s->scale;
+            e.trimmed = s->trimmed;
+            std::memcpy(e.level_end, s->level_end, sizeof(e.level_end));
+            e.offsetL = offset;
+            offset = align(offset + (uint64_t)e.frames * sample_format_size(format));
+            if (e.stereo) {
+                e.offsetR = offset;
+                offset = align(offset + (uint64_t)e.frames * sample_format_size(format));
+            }
+        }
+
+        KitCacheHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, KIT_CACHE_MAGIC, 8);
+        h.version = KIT_CACHE_VERSION;
+        h.sample_rate = sample_rate;
+        h.n_entries = (uint32_t)entries.size();
+        h.format = format;
+        h.trim_db = trim_db;
+        h.kit_hash = kit_cache_hash(sources);
+        h.file_size = offset;
+
+        size_t slash = path.rfind('/');
+        if (slash != std::string::npos && !make_dirs(path.substr(0, slash))) return false;
+
+        char tmp_path[PATH_MAX];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path.c_str(), (int)getpid());
+        FILE* f = fopen(tmp_path, "wb");
+        if (!f) return false;
+
+        bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+                  fwrite(entries.data(), sizeof(KitCacheEntry), entries.size(), f) == entries.size();
+        size_t elem = sample_format_size(format);
+        for (size_t i = 0; ok && i < entries.size(); ++i) {
+            const KitCacheEntry& e = entries[i];
+            ok = pad_to(f, e.offsetL) && fwrite(full[i]->dataL, elem, e.frames, f) == e.frames;
+            if (ok && e.stereo) {
+                ok = pad_to(f, e.offsetR) && fwrite(full[i]->dataR, elem, e.frames, f) == e.frames;
+            }
+        }
+        ok = ok && pad_to(f, h.file_size);
+        ok = (fclose(f) == 0) && ok;
+
+        if (!ok || rename(tmp_path, path.c_str()) != 0) {
+            unlink(tmp_path);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    KitCacheMap(const uint8_t* b, size_t n) : base(b), size(n) {}
+
+    const KitCacheHeader* header() const { return (const KitCacheHeader*)base; }
+    const KitCacheEntry* entries() const { return (const KitCacheEntry*)(base + sizeof(KitCacheHeader)); }
+
+    static uint64_t align(uint64_t n) { return (n + KIT_CACHE_ALIGN - 1) & ~(uint64_t)(KIT_CACHE_ALIGN - 1); }
+
+    static bool pad_to(FILE* f, uint64_t offset) {
+        long pos = ftell(f);
+        if (pos < 0 || (uint64_t)pos > offset) return false;
+        static const char zeros[KIT_CACHE_ALIGN] = {};
+        return fwrite(zeros, 1, offset - pos, f) == offset - pos;
+    }
+
+    // Retorna nullptr se o cache é válido, ou o motivo da rejeição
+    const char* validate(uint32_t sample_rate, SampleFormat format, float trim_db,
+                         const std::vector<KitCacheSource>& sources,
+                         const std::string& bundle_path) const {
+        const KitCacheHeader* h = header();
+        if (std::memcmp(h->magic, KIT_CACHE_MAGIC, 8) != 0 || h->version != KIT_CACHE_VERSION) return "versão";
+        if (h->file_size != size) return "tamanho";
+        if (h->sample_rate != sample_rate) return "taxa de amostragem";
+        if (h->format != format) return "formato";
+        if (h->trim_db != trim_db) return "corte de silêncio";
+        if (h->kit_hash != kit_cache_hash(sources) || h->n_entries != sources.size()) return "definição do kit";
+        if (sizeof(KitCacheHeader) + (uint64_t)h->n_entries * sizeof(KitCacheEntry) > size) return "tamanho";
+
+        for (uint32_t i = 0; i < h->n_entries; ++i) {
+            const KitCacheEntry& e = entries()[i];
+            if (memchr(e.relpath, 0, KIT_CACHE_PATH_MAX) == nullptr) return "entrada inválida";
+            uint64_t bytes = (uint64_t)e.frames * sample_format_size(format);
+            if (e.offsetL + bytes > size || (e.stereo && e.offsetR + bytes > size)) return "entrada inválida";
+            if (e.offsetL % KIT_CACHE_ALIGN || e.offsetR % KIT_CACHE_ALIGN) return "alinhamento";
+
+            struct stat st;
+            int64_t mtime_ns;
+            if (!file_identity(join_path(bundle_path.c_str(), e.relpath), st, mtime_ns) ||
+                (uint64_t)st.st_size != e.src_size || mtime_ns != e.src_mtime_ns) {
+                return "WAV modificado";
+            }
+        }
+        return nullptr;
+    }
+
+    const uint8_t* base;
+    size_t size;
+};
+
+// Identidade de um sample no cache: arquivo (dispositivo, inode, tamanho,
+// modificação) + forma de carregamento. Um arquivo alterado no disco gera
+// uma nova chave e é recarregado.
+struct SampleKey {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    int64_t mtime_ns;
+    bool stereo;
+    uint32_t head_ms;  // 0 = sample inteiro residente
+    uint32_t rate;     // taxa de destino (a do host)
+    SampleFormat format;
+    float trim_db;
+
+    bool operator<(const SampleKey& o) const {
+        if (dev != o.dev) return dev < o.dev;
+        if (ino != o.ino) return ino < o.ino;
+        if (size != o.size) return size < o.size;
+        if (mtime_ns != o.mtime_ns) return mtime_ns < o.mtime_ns;
+        if (stereo != o.stereo) return stereo < o.stereo;
+        if (head_ms != o.head_ms) return head_ms < o.head_ms;
+        if (rate != o.rate) return rate < o.rate;
+        if (format != o.format) return format < o.format;
+        return trim_db < o.trim_db;
+    }
+};
+
+// Cache de samples global ao processo, compartilhado entre instâncias.
+//
+// Guarda apenas referências fracas: os dados pertencem aos RRGroups que os
+// usam e são liberados quando o último deles é destruído (último cleanup()).
+// Usado somente fora da thread de áudio.
+class SampleStore {
+public:
+    static SampleStore& instance() {
+        static SampleStore store;
+        return store;
+    }
+
+    // Obtém um sample na taxa `rate` e no formato `format`, com o silêncio
+    // final cortado em `trim_db`: do próprio store, do cache de kit mapeado
+    // (se houver) ou decodificando (e reamostrando) o WAV
+    std::shared_ptr<const Sample> acquire(const char* bundle_path, const char* relpath, bool force_stereo,
+                                          uint32_t head_ms, uint32_t rate, SampleFormat format, float trim_db,
+                                          const KitCacheMap* cache = nullptr,
+                                          const std::shared_ptr<SampleArena>& arena = nullptr) {
+        std::string full = join_path(bundle_path, relpath);
+        struct stat st;
+        int64_t mtime_ns;
+        if (!file_identity(full, st, mtime_ns)) {
+            fprintf(stderr, "MyDrumKit: Erro ao carregar %s: arquivo não encontrado\n", full.c_str());
+            return nullptr;
+        }
+
+        SampleKey key;
+        key.dev = st.st_dev;
+        key.ino = st.st_ino;
+        key.size = st.st_size;
+        key.mtime_ns = mtime_ns;
+        key.stereo = force_stereo;
+        key.head_ms = head_ms;
+        key.rate = rate;
+        key.format = format;
+        key.trim_db = trim_db;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            purge_expired();
+            auto it = entries.find(key);
+            if (it != entries.end()) {
+                if (auto shared = it->second.lock()) {
+                    ++hits;
+                    return shared;
+                }
+            }
+        }
+
+        // Decodifica fora do lock para não serializar instâncias carregando em paralelo
+        const KitCacheEntry* entry = cache ? cache->find(relpath, force_stereo) : nullptr;
+        Sample s = entry ? cache->sample(*entry, head_ms, full, arena)
+                         : load_wav_from_bundle(bundle_path, relpath, force_stereo, head_ms, rate);
+        if (s.empty()) return nullptr;
+        // Do WAV vem float e sem corte; no modo streaming o sample não é
+        // cortado e só a parte residente é convertida
+        if (!entry) {
+            trim_silence(s, trim_db);
+            if (s.format != format) s = encode_int16(s);
+            pack_into_arena(s, arena);
+        }
+        std::shared_ptr<const Sample> loaded = std::make_shared<const Sample>(std::move(s));
+
+        std::shared_ptr<const Sample> existing;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto& slot = entries[key];
+            existing = slot.lock();
+            if (!existing) {
+                slot = loaded;
+                ++(entry ? mapped : decoded);
+                return loaded;
+            }
+        }
+        // Outra instância carregou o mesmo arquivo enquanto decodificávamos
+        return existing;
+    }
+
+    // Estatísticas do cache (para log)
+    void stats(size_t& n_decoded, size_t& n_mapped, size_t& n_hits) {
+        std::lock_guard<std::mutex> lock(mutex);
+        n_decoded = decoded;
+        n_mapped = mapped;
+        n_hits = hits;
+    }
+
+private:
+    SampleStore() : decoded(0), mapped(0), hits(0) {}
+
+    void purge_expired() {
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (it->second.expired()) it = entries.erase(it);
+            else ++it;
+        }
+    }
+
+    std::mutex mutex;
+    std::map<SampleKey, std::weak_ptr<const Sample>> entries;
+    size_t decoded;  // arquivos decodificados desde o início do processo
+    size_t mapped;   // arquivos obtidos do cache de kit mapeado
+    size_t hits;     // cargas atendidas pelo cache
+};
+
+// Helper para registrar um sample em um grupo RR (carregado depois, em segundo plano)
+static void add_to_rr_group(Kit& kit, RRGroup& group, const std::string& relpath) {
+    group.pending_files++;
+    kit.pending.push_back({group.note, relpath, group.stereo, (uint32_t)group.samples.size()});
+    group.samples.emplace_back();
+    group.layers.back().count++;
+}
+
+// Lê o arquivo de definição do kit (ver kit.txt no bundle) e monta a tabela
+// de notas. Formato por linha, com comentários iniciados por '#':
+//
+//   note <nota> <saída> [stereo] [choke <grupo>] [cuts <grupo>[,<grupo>...]]
+//        [bleed <saída>:<dB>[,<saída>:<dB>...]] [xfade <velocities>]
+//   layer <velocity mínima>   (nova camada de velocity da nota atual)
+//   sample <arquivo relativo ao diretório do kit>
+//
+// Retorna false (com o erro no log) se o arquivo não existe ou é inválido.
+static bool load_kit_file(Kit& kit, const std::string& path) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) {
+        fprintf(stderr, "MyDrumKit: Erro ao abrir o kit %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    size_t slash = path.rfind('/');
+    kit.path = path;
+    kit.dir = slash == std::string::npos ? std::string(".") : path.substr(0, slash);
+
+    RRGroup* group = nullptr;
+    const char* error = nullptr;
+    char line[1024];
+    int line_no = 0;
+    while (!error && fgets(line, sizeof(line), f)) {
+        ++line_no;
+        if (char* hash = strchr(line, '#')) *hash = '\0';
+        size_t len = strlen(line);
+        while (len > 0 && isspace((unsigned char)line[len - 1])) line[--len] = '\0';
+
+        char* p = line;
+        while (isspace((unsigned char)*p)) ++p;
+        if (!*p) continue;
+
+        char word[16];
+        int used = 0;
+        if (sscanf(p, "%15s%n", word, &used) != 1) continue;
+        char* args = p + used;
+        while (isspace((unsigned char)*args)) ++args;
+
+        if (!strcmp(word, "note")) {
+            int note = -1, output = -1;
+            if (sscanf(args, "%d %d%n", &note, &output, &used) != 2) {
+                error = "esperado: note <nota> <saída> [stereo] [choke <grupo>] [cuts <grupos>] [bleed <envios>] [xfade <n>]";
+                break;
+            }
+            if (note < 0 || note > 127) {
+                error = "nota fora do intervalo 0-127";
+                break;
+            }
+            if (kit.note_table[note]) {
+                error = "nota já definida";
+                break;
+            }
+            if (output < 0 || output >= NUM_OUTPUTS) {
+                error = "saída inexistente";
+                break;
+            }
+
+            std::unique_ptr<RRGroup> g(new RRGroup());
+            g->note = note;
+            g->output = output;
+            char* save = nullptr;  // strtok_r: vários kits podem ser lidos ao mesmo tempo
+            for (char* opt = strtok_r(args + used, " \t", &save); opt && !error; opt = strtok_r(nullptr, " \t", &save)) {
+                if (!strcmp(opt, "stereo")) {
+                    g->stereo = true;
+                    if (output + 1 >= NUM_OUTPUTS) error = "grupo estéreo precisa de duas saídas";
+                } else if (!strcmp(opt, "choke")) {
+                    char* id = strtok_r(nullptr, " \t", &save);
+                    g->chokeGroup = id ? atoi(id) : 0;
+                    if (g->chokeGroup <= 0 || g->chokeGroup >= MAX_CHOKE_GROUPS) error = "grupo de choke inválido";
+                    else g->chokeMask |= 1u << g->chokeGroup;
+                } else if (!strcmp(opt, "cuts")) {
+                    char* list = strtok_r(nullptr, " \t", &save);
+                    if (!list) error = "esperado: cuts <grupo>[,<grupo>...]";
+                    for (char* id = list; id && !error; id = strchr(id, ',') ? strchr(id, ',') + 1 : nullptr) {
+                        int cut = atoi(id);
+                        if (cut <= 0 || cut >= MAX_CHOKE_GROUPS) error = "grupo de choke inválido";
+                        else g->chokeMask |= 1u << cut;
+                    }
+                } else if (!strcmp(opt, "xfade")) {
+                    char* width = strtok_r(nullptr, " \t", &save);
+                    g->xfade = width ? atoi(width) : -1;
+                    if (g->xfade < 0 || g->xfade > 127) error = "largura de crossfade inválida";
+                } else if (!strcmp(opt, "bleed")) {
+                    char* list = strtok_r(nullptr, " \t", &save);
+                    if (!list) error = "esperado: bleed <saída>:<dB>[,<saída>:<dB>...]";
+                    for (char* item = list; item && !error; item = strchr(item, ',') ? strchr(item, ',') + 1 : nullptr) {
+                        int out = -1;
+                        float db = 0.0f;
+                        if (sscanf(item, "%d:%f", &out, &db) != 2) error = "esperado: bleed <saída>:<dB>[,<saída>:<dB>...]";
+                        else if (out < 0 || out >= NUM_OUTPUTS) error = "saída de bleed inexistente";
+                        else g->bleed.emplace_back(out, powf(10.0f, db / 20.0f));
+                    }
+                } else {
+                    error = "opção desconhecida";
+                }
+            }
+            group = g.get();
+            kit.note_table[note] = group;
+            kit.groups.push_back(std::move(g));
+        } else if (!strcmp(word, "layer")) {
+            int min_vel = 0;
+            if (!group) error = "layer antes de qualquer note";
+            else if (sscanf(args, "%d", &min_vel) != 1 || min_vel < 1 || min_vel > 127) error = "velocity mínima fora do intervalo 1-127";
+            else if (group->layers.size() == 1 && group->layers[0].count == 0) group->layers[0].min_vel = min_vel;
+            else if (min_vel <= group->layers.back().min_vel) error = "camadas fora da ordem de velocity";
+            else group->layers.push_back({(uint32_t)group->samples.size(), 0, 0, min_vel});
+        } else if (!strcmp(word, "sample")) {
+            if (!group) error = "sample antes de qualquer note";
+            else if (!*args) error = "sample sem arquivo";
+            else add_to_rr_group(kit, *group, args);
+        } else {
+            error = "diretiva desconhecida";
+        }
+    }
+    fclose(f);
+
+    if (error) {
+        fprintf(stderr, "MyDrumKit: %s:%d: %s\n", path.c_str(), line_no, error);
+        return false;
+    }
+    if (kit.pending.empty()) {
+        fprintf(stderr, "MyDrumKit: Kit sem samples: %s\n", path.c_str());
+        return false;
+    }
+
+    // Barramentos: um por canal de saída e conjunto de bleed. Cada um envia
+    // ao seu canal com ganho 1 e às saídas do bleed; nos grupos estéreo os
+    // dois canais enviam ao bleed (soma mono).
+    std::map<std::pair<int, std::vector<std::pair<int, float>>>, int> bus_ids;
+    auto bus_for = [&](int channel, const std::vector<std::pair<int, float>>& bleed) {
+        auto it = bus_ids.find(std::make_pair(channel, bleed));
+        if (it != bus_ids.end()) return it->second;
+        int id = (int)bus_ids.size();
+        bus_ids[std::make_pair(channel, bleed)] = id;
+        kit.sends.push_back({id, channel, 1.0f, false});
+        for (const auto& b : bleed) kit.sends.push_back({id, b.first, b.second, true});
+        return id;
+    };
+    for (const auto& g : kit.groups) {
+        g->build_zones();
+        if (g->samples.empty()) continue;
+        std::sort(g->bleed.begin(), g->bleed.end());
+        g->bus = bus_for(g->output, g->bleed);
+        g->busR = g->stereo ? bus_for(g->output + 1, g->bleed) : g->bus;
+    }
+    if (bus_ids.size() > MAX_BUSES) {
+        fprintf(stderr, "MyDrumKit: %s: combinações demais de saída e bleed (%zu barramentos, máximo %d)\n",
+                path.c_str(), bus_ids.size(), MAX_BUSES);
+        return false;
+    }
+    // Notas sem samples (só cortam outros grupos) já estão prontas
+    for (const auto& g : kit.groups) {
+        if (g->samples.empty()) g->ready.store(true, std::memory_order_release);
+    }
+    fprintf(stderr, "MyDrumKit: Kit %s: %zu notas, %zu samples, %zu barramentos\n",
+            path.c_str(), kit.groups.size(), kit.pending.size(), bus_ids.size());
+    return true;
+}
 
-    Sample() : channels(0), sampleRate(0), is_stereo(false) {}
-};
+// Maior tamanho possível, na arena, da parte residente de um arquivo do kit
+// (WAV inteiro, reamostrado e sem corte de silêncio). Lê só o cabeçalho.
+static size_t arena_bound(const MyDrumKit* self, const Kit* kit, const KitCacheSource& src, const KitCacheMap* cache) {
+    size_t elem = sample_format_size(self->storage);
+    const KitCacheEntry* e = cache ? cache->find(src.relpath.c_str(), src.stereo) : nullptr;
+    if (e) {
+        // Do cache só a parte residente do modo streaming é copiada
+        if (!self->stream_ms) return 0;
+        uint64_t head = std::min<uint64_t>(e->frames, (uint64_t)self->stream_ms * e->sample_rate / 1000);
+        return (e->stereo ? 2 : 1) * (head * elem + SAMPLE_ARENA_ALIGN);
+    }
 
-// Round Robin Group - grupo de samples para uma nota
-struct RRGroup {
-    std::vector<Sample> samples;
-    uint32_t current_rr;  // índice atual do round robin
-    int output;           // saída de áudio (base)
-    int chokeGroup;       // grupo de choke (0 = nenhum)
+    SF_INFO info{};
+    SNDFILE* file = sf_open(join_path(kit->dir.c_str(), src.relpath.c_str()).c_str(), SFM_READ, &info);
+    if (!file) return 0;
+    sf_close(file);
+    if (info.frames <= 0 || info.samplerate <= 0) return 0;
+    uint64_t frames = (uint64_t)info.frames;
+    if ((uint32_t)info.samplerate != self->sample_rate) {
+        frames = frames * self->sample_rate / info.samplerate + 1;
+    } else if (self->stream_ms) {
+        frames = std::min<uint64_t>(frames, (uint64_t)self->stream_ms * info.samplerate / 1000);
+    }
+    int channels = src.stereo && info.channels >= 2 ? 2 : 1;
+    return channels * (frames * elem + SAMPLE_ARENA_ALIGN);
+}
 
-    RRGroup() : current_rr(0), output(0), chokeGroup(0) {}
+// Taxa de amostragem de um WAV (0 se não abrir), só pelo cabeçalho
+static int wav_rate(const std::string& path) {
+    SF_INFO info{};
+    SNDFILE* file = sf_open(path.c_str(), SFM_READ, &info);
+    if (!file) return 0;
+    sf_close(file);
+    return info.samplerate;
+}
 
-    const Sample* getNextSample() {
-        if (samples.empty()) return nullptr;
-        const Sample* s = &samples[current_rr];
-        current_rr = (current_rr + 1) % samples.size();
-        return s;
+// Grava o cache de kit a partir dos samples de `sources` (os que ainda não
+// foram carregados são decodificados do WAV)
+static bool write_kit_cache(MyDrumKit* self, Kit* kit, const std::vector<KitCacheSource>& sources,
+                            const std::string& cache_path) {
+    auto w0 = std::chrono::steady_clock::now();
+    bool ok = false;
+    try {
+        ok = KitCacheMap::write(cache_path, self->sample_rate, self->storage, self->trim_db, sources, kit->dir);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "MyDrumKit: Erro ao gerar cache de kit: %s\n", e.what());
     }
-};
-
-// Estrutura de uma voz ativa
-struct Voice {
-    const Sample* sample;
-    uint32_t pos;
-    uint32_t length;
-    int output;
-    float velocity;   // 0.0 - 1.0
-    int chokeGroup;   // id do grupo de choke desta voz (0 = nenhum)
+    double wms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - w0).count();
+    if (ok) fprintf(stderr, "MyDrumKit: Cache de kit gerado em %.0f ms: %s\n", wms, cache_path.c_str());
+    else fprintf(stderr, "MyDrumKit: AVISO - não foi possível gerar o cache de kit %s\n", cache_path.c_str());
+    return ok;
+}
 
-    Voice() : sample(nullptr), pos(0), length(0), output(0), velocity(1.0f), chokeGroup(0) {}
-};
+// Carrega os samples registrados (thread do worker ou thread própria).
+// Os arquivos distintos são decodificados e reamostrados em paralelo; cada
+// um vai direto para os slots reservados nos grupos que o usam (ordem RR do
+// kit, determinística), e cada grupo é publicado quando fica completo.
+static void load_samples(MyDrumKit* self, Kit* kit) {
+    self->load_done.store(false);
+    self->files_loaded.store(0);
+    self->files_total.store((uint32_t)kit->pending.size());
+    fprintf(stderr, "MyDrumKit: Carregando samples com Round Robin...\n");
+    auto t0 = std::chrono::steady_clock::now();
+
+    // Arquivos distintos do kit (arquivo + estéreo), na ordem de registro,
+    // e as referências (grupo + slot) que usam cada um
+    std::vector<KitCacheSource> sources;
+    std::vector<std::vector<const SampleRef*>> source_refs;
+    std::map<std::pair<std::string, bool>, size_t> source_index;
+    for (const SampleRef& ref : kit->pending) {
+        auto key = std::make_pair(ref.relpath, ref.stereo);
+        if (source_index.find(key) == source_index.end()) {
+            source_index[key] = sources.size();
+            sources.push_back({ref.relpath, ref.stereo, nullptr});
+            source_refs.emplace_back();
+        }
+        source_refs[source_index[key]].push_back(&ref);
+    }
 
-// Estrutura principal do plugin
-struct MyDrumKit {
-    std::map<int, RRGroup> rr_groups;  // nota MIDI -> grupo round robin
-    std::vector<Voice> voices;
-    float* outputs[NUM_OUTPUTS];
-    const LV2_Atom_Sequence* midi_in;
-    LV2_URID midi_event_urid;
+    // Cache de kit pré-decodificado: mapeia se estiver válido
+    std::shared_ptr<KitCacheMap> cache;
+    std::string cache_path;
+    if (self->use_kit_cache) {
+        cache_path = kit_cache_path(kit->path, self->sample_rate, self->storage);
+        if (!cache_path.empty()) {
+            cache = KitCacheMap::open(cache_path, self->sample_rate, self->storage, self->trim_db, sources, kit->dir,
+                                      self->stream_ms == 0);
+        }
+        if (cache) fprintf(stderr, "MyDrumKit: Usando cache de kit %s\n", cache_path.c_str());
+    }
 
-    // Construtor
-    MyDrumKit() : midi_in(nullptr), midi_event_urid(0) {
-        for (int i = 0; i < NUM_OUTPUTS; ++i) {
-            outputs[i] = nullptr;
+    // Streaming de samples que precisam de conversão de taxa: o Streamer lê o
+    // WAV na taxa original, então só o cache de kit tem os dados convertidos.
+    // Sem cache válido, gera o cache antes (o kit inteiro é decodificado uma
+    // vez, e o primeiro golpe espera por isso) e carrega a partir dele.
+    bool cache_tried = false;
+    if (self->stream_ms && !cache && !self->abort_load.load()) {
+        size_t n_resampled = 0;
+        for (const KitCacheSource& src : sources) {
+            int rate = wav_rate(join_path(kit->dir.c_str(), src.relpath.c_str()));
+            if (rate > 0 && (uint32_t)rate != self->sample_rate) ++n_resampled;
+        }
+        if (n_resampled && !cache_path.empty()) {
+            fprintf(stderr, "MyDrumKit: %zu arquivos precisam de conversão para %u Hz: gerando o cache de kit "
+                    "antes da carga, para o streaming\n", n_resampled, self->sample_rate);
+            cache_tried = true;
+            if (write_kit_cache(self, kit, sources, cache_path)) {
+                cache = KitCacheMap::open(cache_path, self->sample_rate, self->storage, self->trim_db, sources,
+                                          kit->dir, false);
+            }
+        }
+        if (n_resampled && !cache) {
+            fprintf(stderr, "MyDrumKit: AVISO - sem cache de kit, MYDRUMKIT_STREAM_MS não vale para %zu arquivos "
+                    "com conversão de taxa: ficam inteiros na memória\n", n_resampled);
         }
     }
-};
 
-// Função para converter caminhos: bundle_path + "/" + rel
-static std::string join_path(const char* bundle_path, const char* rel) {
-    if (!bundle_path || bundle_path[0] == '\0') return std::string(rel);
-    std::string bp(bundle_path);
-    if (bp.back() == '/')
-        return bp + rel;
-    else
-        return bp + "/" + rel;
-}
+    if (cache && self->lock_memory && !self->stream_ms && !cache->lock()) {
+        fprintf(stderr, "MyDrumKit: AVISO - mlock do cache de kit falhou: %s\n", strerror(errno));
+    }
 
-// Função para carregar um arquivo WAV (mantém estéreo se for o caso)
-static Sample load_wav_from_bundle(const char* bundle_path, const char* relpath, bool force_stereo = false) {
-    std::string full = join_path(bundle_path, relpath);
-    const std::string& path = full;
-    SF_INFO info{};
-    SNDFILE* file = sf_open(path.c_str(), SFM_READ, &info);
+    // Arena única para os samples desta carga (ver SampleArena)
+    size_t bound = 0;
+    for (const KitCacheSource& src : sources) bound += arena_bound(self, kit, src, cache.get());
+    std::shared_ptr<SampleArena> arena = SampleArena::create(bound, self->huge_pages);
+
+    parallel_for(sources.size(), [&](size_t i) {
+        if (self->abort_load.load()) return;
+        try {
+            sources[i].sample = SampleStore::instance().acquire(kit->dir.c_str(), sources[i].relpath.c_str(),
+                                                                sources[i].stereo, self->stream_ms,
+                                                                self->sample_rate, self->storage, self->trim_db,
+                                                                cache.get(), arena);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "MyDrumKit: Erro ao carregar %s: %s\n", sources[i].relpath.c_str(), e.what());
+        }
 
-    Sample s;
-    if (!file) {
-        fprintf(stderr, "MyDrumKit: Erro ao carregar %s: %s\n",
-                path.c_str(), sf_strerror(nullptr));
-        return s;
+        for (const SampleRef* ref : source_refs[i]) {
+            RRGroup& group = *kit->note_table[ref->note];
+            group.samples[ref->slot] = sources[i].sample;
+            // acq_rel: quem preenche o último slot enxerga os slots das outras threads
+            if (group.pending_files.fetch_sub(1, std::memory_order_acq_rel) == 1 && !self->abort_load.load()) {
+                group.compact();
+                group.ready.store(true, std::memory_order_release);
+            }
+        }
+        self->files_loaded.fetch_add((uint32_t)source_refs[i].size(), std::memory_order_relaxed);
+    });
+
+    if (arena) arena->finish(self->lock_memory);
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    // Log resumo
+    size_t n_decoded = 0, n_mapped = 0, n_hits = 0;
+    SampleStore::instance().stats(n_decoded, n_mapped, n_hits);
+    fprintf(stderr, "MyDrumKit: Cache de samples: %zu arquivos decodificados, %zu do cache de kit, "
+            "%zu reutilizados (processo)\n", n_decoded, n_mapped, n_hits);
+    fprintf(stderr, "MyDrumKit: %zu notas MIDI carregadas em %.0f ms%s:\n", kit->groups.size(), ms,
+            self->abort_load.load() ? " (interrompido)" : "");
+    std::set<const Sample*> unique;
+    for (int n = 0; n < 128; ++n) {
+        const RRGroup* group = kit->note_table[n];
+        if (!group) continue;
+        uint32_t cuts = group->chokeMask & ~(group->chokeGroup ? 1u << group->chokeGroup : 0u);
+        char cut_list[128] = "";
+        for (int g = 1; g < MAX_CHOKE_GROUPS; ++g) {
+            size_t len = strlen(cut_list);
+            if (cuts & (1u << g)) snprintf(cut_list + len, sizeof(cut_list) - len, "%s%d", len ? "," : ", corta ", g);
+        }
+        fprintf(stderr, "  Nota %d: %zu variações RR em %zu camadas -> saída %d (choke %d%s)\n",
+                n, group->samples.size(), group->layers.size(), group->output, group->chokeGroup, cut_list);
+        for (const auto& sp : group->samples) {
+            if (sp) unique.insert(sp.get());
+        }
     }
 
-    s.channels = info.channels;
-    s.sampleRate = info.samplerate;
-    sf_count_t frames = info.frames;
+    // Erros por arquivo (o motivo de cada um já foi registrado na carga)
+    if (!self->abort_load.load()) {
+        size_t n_failed = 0;
+        for (const KitCacheSource& src : sources) {
+            if (src.sample) continue;
+            if (n_failed++ == 0) fprintf(stderr, "MyDrumKit: AVISO - arquivos não carregados:\n");
+            fprintf(stderr, "  %s\n", src.relpath.c_str());
+        }
+        if (n_failed) fprintf(stderr, "MyDrumKit: %zu de %zu arquivos não carregados\n", n_failed, sources.size());
+    }
 
-    if (frames <= 0 || info.channels <= 0) {
-        fprintf(stderr, "MyDrumKit: Arquivo inválido %s\n", path.c_str());
-        sf_close(file);
-        return s;
+    // Memória ocupada pelos samples (residente x tamanho completo)
+    size_t resident_bytes = 0, full_bytes = 0;
+    for (const Sample* sp : unique) {
+        resident_bytes += (size_t)sp->resident * sp->frame_bytes();
+        full_bytes += (size_t)sp->frames * sp->frame_bytes();
+    }
+    fprintf(stderr, "MyDrumKit: Samples na memória: %.1f MB em %s (completos: %.1f MB%s)\n",
+            resident_bytes / 1048576.0, self->storage == SAMPLE_INT16 ? "int16" : "float",
+            full_bytes / 1048576.0,
+            self->stream_ms ? ", restante via streaming" : "");
+    if (arena && arena->size()) {
+        fprintf(stderr, "MyDrumKit: Arena de samples: %.1f MB contíguos (%s%s)\n", arena->size() / 1048576.0,
+                arena->huge() ? "huge pages" : (self->huge_pages ? "huge pages transparentes" : "páginas normais"),
+                arena->is_locked() ? ", mlock" : "");
     }
 
-    std::vector<float> tmp(frames * info.channels);
-    sf_count_t read = sf_read_float(file, tmp.data(), tmp.size());
-    sf_close(file);
+    // Silêncio removido do fim dos samples (ver trim_silence)
+    if (self->trim_db < 0.0f) {
+        size_t n_trimmed = 0;
+        uint64_t trimmed_frames = 0, trimmed_bytes = 0;
+        for (const Sample* sp : unique) {
+            if (!sp->trimmed) continue;
+            ++n_trimmed;
+            trimmed_frames += sp->trimmed;
+            trimmed_bytes += (uint64_t)sp->trimmed * sp->frame_bytes();
+        }
+        fprintf(stderr, "MyDrumKit: Corte de silêncio (%.0f dB): %zu de %zu samples, %llu frames, %.1f MB economizados\n",
+                self->trim_db, n_trimmed, unique.size(), (unsigned long long)trimmed_frames, trimmed_bytes / 1048576.0);
+    }
 
-    if (read != tmp.size()) {
-        fprintf(stderr, "MyDrumKit: Leitura incompleta de %s\n", path.c_str());
+    // Gera o cache de kit para as próximas cargas (já com o kit tocável)
+    if (self->use_kit_cache && !cache && !cache_tried && !cache_path.empty() && !self->abort_load.load()) {
+        write_kit_cache(self, kit, sources, cache_path);
     }
 
-    // Se force_stereo está ativo E o arquivo é estéreo, mantém estéreo
-    if (force_stereo && info.channels >= 2) {
-        s.is_stereo = true;
-        s.dataL.resize(frames);
-        s.dataR.resize(frames);
+    self->load_done.store(true);
+}
+
+// Libera um kit fora da thread de áudio (worker, thread de carga ou
+// cleanup), depois que a leitora do streaming soltou os seus samples
+static void free_kit(MyDrumKit* self, Kit* kit) {
+    if (!kit) return;
+    if (self->stream_ms) self->streamer.sync();
+    fprintf(stderr, "MyDrumKit: Kit %s liberado\n", kit->path.c_str());
+    delete kit;
+}
 
-        for (sf_count_t i = 0; i < frames; ++i) {
-            s.dataL[i] = tmp[i * info.channels + 0];      // Canal L
-            s.dataR[i] = tmp[i * info.channels + 1];      // Canal R
+// Troca de kit (worker ou thread própria): lê e carrega o kit novo inteiro
+// e o entrega ao run() em `next_kit`. O kit atual continua tocando durante
+// a carga e também se o arquivo novo for inválido (retorna false).
+static bool switch_kit(MyDrumKit* self, const std::string& path) {
+    fprintf(stderr, "MyDrumKit: Trocando para o kit %s\n", path.c_str());
+    std::unique_ptr<Kit> kit;
+    try {
+        kit.reset(new Kit());
+        if (!load_kit_file(*kit, path)) {
+            fprintf(stderr, "MyDrumKit: Troca de kit cancelada, mantendo o kit atual\n");
+            return false;
         }
-        s.channels = 2;
-        fprintf(stderr, "MyDrumKit: Carregado %s (ESTÉREO, %d Hz, %lld frames)\n",
-                relpath, s.sampleRate, (long long)frames);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "MyDrumKit: Erro ao ler o kit %s: %s\n", path.c_str(), e.what());
+        return false;
     }
-    // Senão, converte para mono
-    else if (info.channels == 1) {
-        s.is_stereo = false;
-        s.dataL = std::move(tmp);
-        s.channels = 1;
-        fprintf(stderr, "MyDrumKit: Carregado %s (mono, %d Hz, %lld frames)\n",
-                relpath, s.sampleRate, (long long)frames);
-    } else {
-        // Converte para mono (média dos canais)
-        s.is_stereo = false;
-        s.dataL.resize(frames);
-        for (sf_count_t i = 0; i < frames; ++i) {
-            float sum = 0.0f;
-            for (int c = 0; c < info.channels; ++c) {
-                sum += tmp[i * info.channels + c];
-            }
-            s.dataL[i] = sum / (float)info.channels;
-        }
-        s.channels = 1;
-        fprintf(stderr, "MyDrumKit: Carregado %s (%d canais -> mono, %d Hz, %lld frames)\n",
-                relpath, info.channels, s.sampleRate, (long long)frames);
+    {
+        std::lock_guard<std::mutex> lock(self->kit_mutex);
+        self->kit_selected = path;
     }
 
-    return s;
+    load_samples(self, kit.get());
+    if (self->abort_load.load()) return true;
+
+    // Um kit entregue antes e ainda não trocado nunca tocou: sai direto
+    delete self->next_kit.exchange(kit.release(), std::memory_order_acq_rel);
+    fprintf(stderr, "MyDrumKit: Kit %s pronto, trocando no próximo bloco\n", path.c_str());
+    return true;
 }
 
-// Helper para adicionar sample a um grupo RR
-static void add_to_rr_group(MyDrumKit* self, int note, const char* bundle_path,
-                           const char* relpath, int output, bool force_stereo = false) {
-    Sample s = load_wav_from_bundle(bundle_path, relpath, force_stereo);
-    if (!s.dataL.empty()) {
-        auto& group = self->rr_groups[note];
-        group.samples.push_back(std::move(s));
-        group.output = output;
+// Pedido de troca de kit do restore() (fora da thread de áudio). Com worker,
+// o próximo run() agenda WORK_RESTORE_KIT, que lê o pedido mais recente; sem
+// worker, uma thread própria carrega o kit depois da carga anterior.
+static void request_kit(MyDrumKit* self, const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(self->kit_mutex);
+        self->kit_requested = path;
+    }
+    if (self->schedule) {
+        self->restore_pending.store(true, std::memory_order_release);
+        return;
+    }
+
+    if (self->loader.joinable()) self->loader.join();
+    free_kit(self, self->garbage.exchange(nullptr, std::memory_order_acquire));
+    try {
+        self->loading.store(true);
+        self->loader = std::thread([self, path]() {
+            switch_kit(self, path);
+            self->loading.store(false);
+        });
+    } catch (const std::exception& e) {
+        fprintf(stderr, "MyDrumKit: Erro ao criar thread de carga: %s\n", e.what());
+        self->loading.store(false);
     }
 }
 
 // Inicialização do plugin
-static LV2_Handle instantiate(const LV2_Descriptor* desc,
+static LV2_Handle instantiate(const LV2_Descriptor*,
                               double sample_rate,
                               const char* bundle_path,
                               const LV2_Feature* const* features) {
@@ -198,8 +2833,25 @@ static LV2_Handle instantiate(const LV2_Descriptor* desc,
         }
     }
 
+    // Worker do host (opcional): sem ele, os samples são carregados por uma thread própria
+    for (const LV2_Feature* const* f = features; f && *f; ++f) {
+        if (!strcmp((*f)->URI, LV2_WORKER__schedule)) {
+            self->schedule = (LV2_Worker_Schedule*)(*f)->data;
+            break;
+        }
+    }
+
     if (map) {
         self->midi_event_urid = map->map(map->handle, LV2_MIDI__MidiEvent);
+        self->atom_object_urid = map->map(map->handle, LV2_ATOM__Object);
+        self->atom_path_urid = map->map(map->handle, LV2_ATOM__Path);
+        self->atom_urid_urid = map->map(map->handle, LV2_ATOM__URID);
+        self->patch_set_urid = map->map(map->handle, LV2_PATCH__Set);
+        self->patch_get_urid = map->map(map->handle, LV2_PATCH__Get);
+        self->patch_property_urid = map->map(map->handle, LV2_PATCH__property);
+        self->patch_value_urid = map->map(map->handle, LV2_PATCH__value);
+        self->kit_urid = map->map(map->handle, MYDRUMKIT_URI "#kit");
+        self->telemetry.map_uris(map);
         fprintf(stderr, "MyDrumKit: URID mapeado: %u\n", self->midi_event_urid);
     } else {
         fprintf(stderr, "MyDrumKit: AVISO - URID map não encontrado!\n");
@@ -207,197 +2859,103 @@ static LV2_Handle instantiate(const LV2_Descriptor* desc,
         return nullptr;
     }
 
-    // Carrega samples com Round Robin
-    try {
-        fprintf(stderr, "MyDrumKit: Carregando samples com Round Robin...\n");
-
-        // KICK (nota 36) - saída 0 (Kick)
-        add_to_rr_group(self, 36, bundle_path, "samples/kick_v1_r1.wav", 0);
-        add_to_rr_group(self, 36, bundle_path, "samples/kick_v1_r2.wav", 0);
-        add_to_rr_group(self, 36, bundle_path, "samples/kick_v1_r3.wav", 0);
-        add_to_rr_group(self, 36, bundle_path, "samples/kick_v1_r4.wav", 0);
-        add_to_rr_group(self, 36, bundle_path, "samples/kick_v1_r5.wav", 0);
-        add_to_rr_group(self, 36, bundle_path, "samples/kick_v1_r6.wav", 0);
-
-        // SIDESTICK (nota 37) - saída 1 (Snare)
-        add_to_rr_group(self, 37, bundle_path, "samples/sidestick_v1_r1.wav", 1);
-        add_to_rr_group(self, 37, bundle_path, "samples/sidestick_v1_r2.wav", 1);
-        add_to_rr_group(self, 37, bundle_path, "samples/sidestick_v1_r3.wav", 1);
-        add_to_rr_group(self, 37, bundle_path, "samples/sidestick_v1_r4.wav", 1);
-        add_to_rr_group(self, 37, bundle_path, "samples/sidestick_v1_r5.wav", 1);
-        add_to_rr_group(self, 37, bundle_path, "samples/sidestick_v1_r6.wav", 1);
-
-        // SNARE (nota 38) - saída 1 (Snare)
-        add_to_rr_group(self, 38, bundle_path, "samples/snare_v1_r1.wav", 1);
-        add_to_rr_group(self, 38, bundle_path, "samples/snare_v1_r2.wav", 1);
-        add_to_rr_group(self, 38, bundle_path, "samples/snare_v1_r3.wav", 1);
-        add_to_rr_group(self, 38, bundle_path, "samples/snare_v1_r4.wav", 1);
-        add_to_rr_group(self, 38, bundle_path, "samples/snare_v1_r5.wav", 1);
-        add_to_rr_group(self, 38, bundle_path, "samples/snare_v1_r6.wav", 1);
-
-        // SNARE (nota 40) - saída 1 (Snare)
-        add_to_rr_group(self, 40, bundle_path, "samples/snare_v1_r1.wav", 1);
-        add_to_rr_group(self, 40, bundle_path, "samples/snare_v1_r2.wav", 1);
-        add_to_rr_group(self, 40, bundle_path, "samples/snare_v1_r3.wav", 1);
-        add_to_rr_group(self, 40, bundle_path, "samples/snare_v1_r4.wav", 1);
-        add_to_rr_group(self, 40, bundle_path, "samples/snare_v1_r5.wav", 1);
-        add_to_rr_group(self, 40, bundle_path, "samples/snare_v1_r6.wav", 1);
-
-        // HIHAT CLOSED (nota 42) - saída 2 (HiHat)
-        add_to_rr_group(self, 42, bundle_path, "samples/hihat_closed_v1_r1.wav", 2);
-        add_to_rr_group(self, 42, bundle_path, "samples/hihat_closed_v1_r2.wav", 2);
-        add_to_rr_group(self, 42, bundle_path, "samples/hihat_closed_v1_r3.wav", 2);
-        add_to_rr_group(self, 42, bundle_path, "samples/hihat_closed_v1_r4.wav", 2);
-        add_to_rr_group(self, 42, bundle_path, "samples/hihat_closed_v1_r5.wav", 2);
-        add_to_rr_group(self, 42, bundle_path, "samples/hihat_closed_v1_r6.wav", 2);
-
-        // HIHAT OPEN (nota 46) - saída 2 (HiHat)
-        add_to_rr_group(self, 46, bundle_path, "samples/hihat_open_v1_r1.wav", 2);
-        add_to_rr_group(self, 46, bundle_path, "samples/hihat_open_v1_r2.wav", 2);
-        add_to_rr_group(self, 46, bundle_path, "samples/hihat_open_v1_r3.wav", 2);
-        add_to_rr_group(self, 46, bundle_path, "samples/hihat_open_v1_r4.wav", 2);
-        add_to_rr_group(self, 46, bundle_path, "samples/hihat_open_v1_r5.wav", 2);
-        add_to_rr_group(self, 46, bundle_path, "samples/hihat_open_v1_r6.wav", 2);
-
-        // HIHAT PEDAL (nota 44) - saída 2 (HiHat)
-        add_to_rr_group(self, 44, bundle_path, "samples/hihat_pedal_v1_r1.wav", 2);
-        add_to_rr_group(self, 44, bundle_path, "samples/hihat_pedal_v1_r2.wav", 2);
-        add_to_rr_group(self, 44, bundle_path, "samples/hihat_pedal_v1_r3.wav", 2);
-        add_to_rr_group(self, 44, bundle_path, "samples/hihat_pedal_v1_r4.wav", 2);
-        add_to_rr_group(self, 44, bundle_path, "samples/hihat_pedal_v1_r5.wav", 2);
-        add_to_rr_group(self, 44, bundle_path, "samples/hihat_pedal_v1_r6.wav", 2);
-
-        // SNARE FX (nota 39) - saída 1 (Snare)
-        add_to_rr_group(self, 39, bundle_path, "samples/snare_v1_r1.wav", 3);
-        add_to_rr_group(self, 39, bundle_path, "samples/snare_v1_r2.wav", 3);
-        add_to_rr_group(self, 39, bundle_path, "samples/snare_v1_r3.wav", 3);
-        add_to_rr_group(self, 39, bundle_path, "samples/snare_v1_r4.wav", 3);
-        add_to_rr_group(self, 39, bundle_path, "samples/snare_v1_r5.wav", 3);
-        add_to_rr_group(self, 39, bundle_path, "samples/snare_v1_r6.wav", 3);
-
-        // RACK TOM 1 (nota 50) - saída 3 (RackTom1)
-        add_to_rr_group(self, 50, bundle_path, "samples/racktom1_v1_r1.wav", 4);
-        add_to_rr_group(self, 50, bundle_path, "samples/racktom1_v1_r2.wav", 4);
-        add_to_rr_group(self, 50, bundle_path, "samples/racktom1_v1_r3.wav", 4);
-        add_to_rr_group(self, 50, bundle_path, "samples/racktom1_v1_r4.wav", 4);
-        add_to_rr_group(self, 50, bundle_path, "samples/racktom1_v1_r5.wav", 4);
-        add_to_rr_group(self, 50, bundle_path, "samples/racktom1_v1_r6.wav", 4);
-
-        // RACK TOM 2 (nota 48) - saída 4 (RackTom2)
-        add_to_rr_group(self, 48, bundle_path, "samples/racktom2_v1_r1.wav", 5);
-        add_to_rr_group(self, 48, bundle_path, "samples/racktom2_v1_r2.wav", 5);
-        add_to_rr_group(self, 48, bundle_path, "samples/racktom2_v1_r3.wav", 5);
-        add_to_rr_group(self, 48, bundle_path, "samples/racktom2_v1_r4.wav", 5);
-        add_to_rr_group(self, 48, bundle_path, "samples/racktom2_v1_r5.wav", 5);
-        add_to_rr_group(self, 48, bundle_path, "samples/racktom2_v1_r6.wav", 5);
-
-        // RACK TOM 3 (nota 47) - saída 5 (RackTom3)
-        add_to_rr_group(self, 47, bundle_path, "samples/racktom3_v1_r1.wav", 6);
-        add_to_rr_group(self, 47, bundle_path, "samples/racktom3_v1_r2.wav", 6);
-        add_to_rr_group(self, 47, bundle_path, "samples/racktom3_v1_r3.wav", 6);
-        add_to_rr_group(self, 47, bundle_path, "samples/racktom3_v1_r4.wav", 6);
-        add_to_rr_group(self, 47, bundle_path, "samples/racktom3_v1_r5.wav", 6);
-        add_to_rr_group(self, 47, bundle_path, "samples/racktom3_v1_r6.wav", 6);
-
-        // FLOOR TOM 1 (nota 45) - saída 6 (FloorTom1)
-        add_to_rr_group(self, 45, bundle_path, "samples/floortom1_v1_r1.wav", 7);
-        add_to_rr_group(self, 45, bundle_path, "samples/floortom1_v1_r2.wav", 7);
-        add_to_rr_group(self, 45, bundle_path, "samples/floortom1_v1_r3.wav", 7);
-        add_to_rr_group(self, 45, bundle_path, "samples/floortom1_v1_r4.wav", 7);
-        add_to_rr_group(self, 45, bundle_path, "samples/floortom1_v1_r5.wav", 7);
-        add_to_rr_group(self, 45, bundle_path, "samples/floortom1_v1_r6.wav", 7);
-
-        // FLOOR TOM 2 (nota 43) - saída 7 (FloorTom2)
-        add_to_rr_group(self, 43, bundle_path, "samples/floortom2_v1_r1.wav", 8);
-        add_to_rr_group(self, 43, bundle_path, "samples/floortom2_v1_r2.wav", 8);
-        add_to_rr_group(self, 43, bundle_path, "samples/floortom2_v1_r3.wav", 8);
-        add_to_rr_group(self, 43, bundle_path, "samples/floortom2_v1_r4.wav", 8);
-        add_to_rr_group(self, 43, bundle_path, "samples/floortom2_v1_r5.wav", 8);
-        add_to_rr_group(self, 43, bundle_path, "samples/floortom2_v1_r6.wav", 8);
-
-        // FLOOR TOM 3 (nota 41) - saída 8 (FloorTom3)
-        add_to_rr_group(self, 41, bundle_path, "samples/floortom3_v1_r1.wav", 9);
-        add_to_rr_group(self, 41, bundle_path, "samples/floortom3_v1_r2.wav", 9);
-        add_to_rr_group(self, 41, bundle_path, "samples/floortom3_v1_r3.wav", 9);
-        add_to_rr_group(self, 41, bundle_path, "samples/floortom3_v1_r4.wav", 9);
-        add_to_rr_group(self, 41, bundle_path, "samples/floortom3_v1_r5.wav", 9);
-        add_to_rr_group(self, 41, bundle_path, "samples/floortom3_v1_r6.wav", 9);
-
-        // CRASH 1 (nota 49) - saída 9/10 (Overhead L/R) - ESTÉREO
-        add_to_rr_group(self, 49, bundle_path, "samples/crash1_v1_r1.wav", 10, true);
-        add_to_rr_group(self, 49, bundle_path, "samples/crash1_v1_r2.wav", 10, true);
-        add_to_rr_group(self, 49, bundle_path, "samples/crash1_v1_r3.wav", 10, true);
-        add_to_rr_group(self, 49, bundle_path, "samples/crash1_v1_r4.wav", 10, true);
-        add_to_rr_group(self, 49, bundle_path, "samples/crash1_v1_r5.wav", 10, true);
-        add_to_rr_group(self, 49, bundle_path, "samples/crash1_v1_r6.wav", 10, true);
-
-        // CRASH 2 (nota 57) - saída 9/10 (Overhead L/R) - ESTÉREO
-        add_to_rr_group(self, 57, bundle_path, "samples/crash2_v1_r1.wav", 10, true);
-        add_to_rr_group(self, 57, bundle_path, "samples/crash2_v1_r2.wav", 10, true);
-        add_to_rr_group(self, 57, bundle_path, "samples/crash2_v1_r3.wav", 10, true);
-        add_to_rr_group(self, 57, bundle_path, "samples/crash2_v1_r4.wav", 10, true);
-        add_to_rr_group(self, 57, bundle_path, "samples/crash2_v1_r5.wav", 10, true);
-        add_to_rr_group(self, 57, bundle_path, "samples/crash2_v1_r6.wav", 10, true);
-
-        // RIDE BOW (nota 51) - saída 9/10 (Overhead L/R) - ESTÉREO
-        add_to_rr_group(self, 51, bundle_path, "samples/ride_bow_v1_r1.wav", 10, true);
-        add_to_rr_group(self, 51, bundle_path, "samples/ride_bow_v1_r2.wav", 10, true);
-        add_to_rr_group(self, 51, bundle_path, "samples/ride_bow_v1_r3.wav", 10, true);
-        add_to_rr_group(self, 51, bundle_path, "samples/ride_bow_v1_r4.wav", 10, true);
-        add_to_rr_group(self, 51, bundle_path, "samples/ride_bow_v1_r5.wav", 10, true);
-        add_to_rr_group(self, 51, bundle_path, "samples/ride_bow_v1_r6.wav", 10, true);
-
-        // RIDE BELL (nota 53) - saída 9/10 (Overhead L/R) - ESTÉREO
-        add_to_rr_group(self, 53, bundle_path, "samples/ride_bell_v1_r1.wav", 10, true);
-        add_to_rr_group(self, 53, bundle_path, "samples/ride_bell_v1_r2.wav", 10, true);
-        add_to_rr_group(self, 53, bundle_path, "samples/ride_bell_v1_r3.wav", 10, true);
-        add_to_rr_group(self, 53, bundle_path, "samples/ride_bell_v1_r4.wav", 10, true);
-        add_to_rr_group(self, 53, bundle_path, "samples/ride_bell_v1_r5.wav", 10, true);
-        add_to_rr_group(self, 53, bundle_path, "samples/ride_bell_v1_r6.wav", 10, true);
-
-        // RIDE EDGE (nota 59) - saída 9/10 (Overhead L/R) - ESTÉREO
-        add_to_rr_group(self, 59, bundle_path, "samples/ride_edge_v1_r1.wav", 10, true);
-        add_to_rr_group(self, 59, bundle_path, "samples/ride_edge_v1_r2.wav", 10, true);
-        add_to_rr_group(self, 59, bundle_path, "samples/ride_edge_v1_r3.wav", 10, true);
-        add_to_rr_group(self, 59, bundle_path, "samples/ride_edge_v1_r4.wav", 10, true);
-        add_to_rr_group(self, 59, bundle_path, "samples/ride_edge_v1_r5.wav", 10, true);
-        add_to_rr_group(self, 59, bundle_path, "samples/ride_edge_v1_r6.wav", 10, true);
-
-        // CHINA (nota 52) - saída 9/10 (Overhead L/R) - ESTÉREO
-        add_to_rr_group(self, 52, bundle_path, "samples/china_v1_r1.wav", 10, true);
-        add_to_rr_group(self, 52, bundle_path, "samples/china_v1_r2.wav", 10, true);
-        add_to_rr_group(self, 52, bundle_path, "samples/china_v1_r3.wav", 10, true);
-        add_to_rr_group(self, 52, bundle_path, "samples/china_v1_r4.wav", 10, true);
-        add_to_rr_group(self, 52, bundle_path, "samples/china_v1_r5.wav", 10, true);
-        add_to_rr_group(self, 52, bundle_path, "samples/china_v1_r6.wav", 10, true);
-
-        // SPLASH (nota 55) - saída 9/10 (Overhead L/R) - ESTÉREO
-        add_to_rr_group(self, 55, bundle_path, "samples/splash_v1_r1.wav", 10, true);
-        add_to_rr_group(self, 55, bundle_path, "samples/splash_v1_r2.wav", 10, true);
-        add_to_rr_group(self, 55, bundle_path, "samples/splash_v1_r3.wav", 10, true);
-        add_to_rr_group(self, 55, bundle_path, "samples/splash_v1_r4.wav", 10, true);
-        add_to_rr_group(self, 55, bundle_path, "samples/splash_v1_r5.wav", 10, true);
-        add_to_rr_group(self, 55, bundle_path, "samples/splash_v1_r6.wav", 10, true);
-
-        // Define grupos de choke (HiHat)
-        self->rr_groups[46].chokeGroup = 1; // open
-        self->rr_groups[42].chokeGroup = 1; // closed
-        self->rr_groups[44].chokeGroup = 1; // pedal
-
-        // Log resumo
-        fprintf(stderr, "MyDrumKit: %zu notas MIDI carregadas:\n", self->rr_groups.size());
-        for (const auto& pair : self->rr_groups) {
-            fprintf(stderr, "  Nota %d: %zu variações RR -> saída %d (choke %d)\n",
-                    pair.first, pair.second.samples.size(), pair.second.output, pair.second.chokeGroup);
+    self->sample_rate = (uint32_t)(sample_rate + 0.5);
+
+    // Rampa de release de choke e roubo de voz
+    self->voices.release_frames = std::max(1u, (uint32_t)((uint64_t)RELEASE_MS * self->sample_rate / 1000));
+    self->fade_bufL.assign(self->voices.release_frames, 0.0f);
+    self->fade_bufR.assign(self->voices.release_frames, 0.0f);
+    self->smooth_frames = (uint32_t)((uint64_t)GAIN_SMOOTH_MS * self->sample_rate / 1000);
+
+    // Saídas esparsas: só vale se o host não escreve nos buffers de saída do
+    // plugin entre dois run() (processamento in-place a jusante quebraria)
+    if (const char* env = getenv("MYDRUMKIT_SPARSE")) {
+        self->sparse_outputs = atoi(env) != 0;
+    }
+
+    // Cache de kit pré-decodificado (ligado por padrão; MYDRUMKIT_CACHE=0 desliga)
+    if (const char* env = getenv("MYDRUMKIT_CACHE")) {
+        self->use_kit_cache = atoi(env) != 0;
+    }
+
+    // Período da telemetria (padrão: um bloco por evento)
+    if (const char* env = getenv("MYDRUMKIT_TELEMETRY_MS")) {
+        int ms = atoi(env);
+        if (ms > 0) self->telemetry.period_frames = (uint32_t)((uint64_t)ms * self->sample_rate / 1000);
+    }
+
+    self->mix = select_mix_kernels(getenv("MYDRUMKIT_SIMD"));
+    fprintf(stderr, "MyDrumKit: Mixagem %s\n", self->mix->name);
+
+    // Formato dos samples na memória: float (padrão) ou int16 com escala por sample
+    if (const char* env = getenv("MYDRUMKIT_STORAGE")) {
+        if (!strcmp(env, "int16")) self->storage = SAMPLE_INT16;
+        else if (strcmp(env, "float") != 0) fprintf(stderr, "MyDrumKit: AVISO - MYDRUMKIT_STORAGE=%s desconhecido, usando float\n", env);
+    }
+
+    // Memória dos samples: MYDRUMKIT_MEMORY=hugepages,mlock (um ou ambos)
+    if (const char* env = getenv("MYDRUMKIT_MEMORY")) {
+        self->huge_pages = strstr(env, "hugepages") != nullptr;
+        self->lock_memory = strstr(env, "mlock") != nullptr;
+    }
+
+    // Corte do silêncio final dos samples: limiar em dBFS (0 desliga)
+    if (const char* env = getenv("MYDRUMKIT_TRIM_DB")) {
+        self->trim_db = std::min(0.0f, (float)atof(env));
+    }
+
+    // Modo streaming (opcional): MYDRUMKIT_STREAM_MS = milissegundos residentes por sample
+    if (const char* env = getenv("MYDRUMKIT_STREAM_MS")) {
+        int ms = atoi(env);
+        if (ms > 0) {
+            if (self->streamer.init(self->voices.capacity())) {
+                self->stream_ms = (uint32_t)ms;
+                self->voices.streamer = &self->streamer;
+                fprintf(stderr, "MyDrumKit: Streaming ativado (%u ms residentes por sample)\n", self->stream_ms);
+            } else {
+                fprintf(stderr, "MyDrumKit: AVISO - falha ao iniciar o streaming, carregando samples inteiros\n");
+            }
         }
+    }
 
+    // Definição do kit: MYDRUMKIT_KIT (absoluto ou relativo ao bundle) ou kit.txt no bundle.
+    // Os samples são só registrados aqui; o carregamento acontece em segundo plano.
+    // O estado salvo pelo host (restore) ou um patch:Set podem trocar o kit depois.
+    try {
+        const char* kit = getenv("MYDRUMKIT_KIT");
+        if (!kit || !*kit) kit = "kit.txt";
+        std::string kit_path = kit[0] == '/' ? std::string(kit) : join_path(bundle_path, kit);
+        self->kit = new Kit();
+        if (!load_kit_file(*self->kit, kit_path)) {
+            delete self;
+            return nullptr;
+        }
+        self->kit_selected = self->kit_requested = kit_path;
+        self->files_total.store((uint32_t)self->kit->pending.size());
     } catch (const std::exception& e) {
-        fprintf(stderr, "MyDrumKit: Erro ao carregar samples: %s\n", e.what());
+        fprintf(stderr, "MyDrumKit: Erro ao registrar samples: %s\n", e.what());
         delete self;
         return nullptr;
     }
 
-    fprintf(stderr, "MyDrumKit: Instanciação completa\n");
+    // Sem worker: carrega em uma thread própria. Com worker, o primeiro run() agenda a carga.
+    if (!self->schedule) {
+        try {
+            self->loading.store(true);
+            self->loader = std::thread([self]() {
+                load_samples(self, self->kit);
+                self->loading.store(false);
+            });
+        } catch (const std::exception& e) {
+            fprintf(stderr, "MyDrumKit: Erro ao criar thread de carga: %s\n", e.what());
+            self->loading.store(false);
+            delete self;
+            return nullptr;
+        }
+    }
+
+    fprintf(stderr, "MyDrumKit: Instanciação completa (%zu samples em carregamento, %s)\n",
+            self->kit->pending.size(), self->schedule ? "worker do host" : "thread própria");
     return (LV2_Handle)self;
 }
 
@@ -409,111 +2967,496 @@ static void connect_port(LV2_Handle instance, uint32_t port, void* data) {
     if (port == 0) {
         self->midi_in = (const LV2_Atom_Sequence*)data;
     } else if (port >= 1 && port <= NUM_OUTPUTS) {
+        if (self->outputs[port - 1] != (float*)data) self->out_zeroed[port - 1] = 0;
         self->outputs[port - 1] = (float*)data;
+    } else if (port == PORT_PROGRESS) {
+        self->progress = (float*)data;
+    } else if (port == PORT_TELEMETRY) {
+        self->telemetry_out = (LV2_Atom_Sequence*)data;
+    } else if (port >= PORT_GAIN && port < PORT_GAIN + NUM_OUTPUTS) {
+        self->gain_ports[port - PORT_GAIN] = (const float*)data;
+    } else if (port == PORT_BLEED) {
+        self->bleed_port = (const float*)data;
+    } else if (port == PORT_ACTIVITY) {
+        self->activity = (float*)data;
     }
 }
 
-// Execução (processamento de áudio e MIDI)
-static void run(LV2_Handle instance, uint32_t n_samples) {
-    MyDrumKit* self = (MyDrumKit*)instance;
-    if (!self) return;
+// Mistura n frames de um trecho contíguo do sample nas saídas a partir do frame i.
+// outR é nullptr para vozes mono; saídas não conectadas são ignoradas.
+static inline void mix_span(const MixKernels* mix, float* outL, float* outR, uint32_t i,
+                            const float* srcL, const float* srcR, float gain, uint32_t n) {
+    if (n == 0) return;
+    if (outL && outR) {
+        mix->stereo(outL + i, outR + i, srcL, srcR, gain, n);
+    } else if (outL) {
+        mix->mono(outL + i, srcL, gain, n);
+    } else if (outR) {
+        mix->mono(outR + i, srcR, gain, n);
+    }
+}
+
+// Idem para samples int16; `gain` já inclui a escala do sample
+static inline void mix_span(const MixKernels* mix, float* outL, float* outR, uint32_t i,
+                            const int16_t* srcL, const int16_t* srcR, float gain, uint32_t n) {
+    if (n == 0) return;
+    if (outL && outR) {
+        mix->stereo16(outL + i, outR + i, srcL, srcR, gain, n);
+    } else if (outL) {
+        mix->mono16(outL + i, srcL, gain, n);
+    } else if (outR) {
+        mix->mono16(outR + i, srcR, gain, n);
+    }
+}
+
+// Mistura os próximos n_frames frames de uma voz em outL/outR a partir do
+// frame i (parte residente e, no modo streaming, o restante vindo do disco)
+static void mix_voice(MyDrumKit* self, int slot, Voice& v, float* outL, float* outR, uint32_t i, uint32_t n_frames) {
+    const Sample* s = v.sample;
+    uint32_t end = i + n_frames;
+
+    // Parte residente do sample (até o fim efetivo da voz)
+    uint32_t resident = std::min(s->resident, v.length);
+    if (v.pos < resident) {
+        uint32_t n = std::min(end - i, resident - v.pos);
+        if (s->format == SAMPLE_INT16) {
+            const int16_t* dataL = (const int16_t*)s->dataL + v.pos;
+            const int16_t* dataR = v.stereo ? (const int16_t*)s->dataR + v.pos : nullptr;
+            mix_span(self->mix, outL, outR, i, dataL, dataR, v.velocity * s->scale, n);
+        } else {
+            const float* dataL = (const float*)s->dataL + v.pos;
+            const float* dataR = v.stereo ? (const float*)s->dataR + v.pos : nullptr;
+            mix_span(self->mix, outL, outR, i, dataL, dataR, v.velocity, n);
+        }
+        v.pos += n;
+        i += n;
+    }
+
+    // Restante vindo do disco (modo streaming)
+    if (i < end && v.streamed && v.pos < v.length) {
+        Streamer& st = self->streamer;
+        uint32_t want = std::min(end - i, v.length - v.pos);
+        uint32_t got = st.available(slot, v.pos, want);
+
+        // O buffer circular pode dar a volta: até dois trechos
+        uint32_t idx = v.pos & (STREAM_RING_FRAMES - 1);
+        uint32_t first = std::min(got, (uint32_t)STREAM_RING_FRAMES - idx);
+        const float* ringL = st.ringL(slot);
+        const float* ringR = v.stereo ? st.ringR(slot) : nullptr;
+        mix_span(self->mix, outL, outR, i, ringL + idx, ringR ? ringR + idx : nullptr, v.velocity, first);
+        mix_span(self->mix, outL, outR, i + first, ringL, ringR, v.velocity, got - first);
+
+        // Dados não chegaram a tempo: silêncio no resto do trecho, sem bloquear
+        if (got < want) st.underrun();
+
+        v.pos += want;
+        st.consumed(slot, v.pos);
+    }
+}
+
+// Renderiza as vozes ativas no trecho [offset, offset + n_frames) dos barramentos
+static void render_voices(MyDrumKit* self, uint32_t offset, uint32_t n_frames) {
+    if (n_frames == 0) return;
+
+    // Mixa na ordem de disparo; as vozes que terminam são liberadas depois
+    // do laço, para a remoção por swap não mudar a ordem desta passada
+    VoicePool& pool = self->voices;
+    pool.sort_active();
+    int finished[MAX_VOICES + MAX_RELEASE_VOICES];
+    int n_finished = 0;
+    for (int a = 0; a < pool.size(); ++a) {
+        int slot = pool.active[a];
+        Voice& v = pool.slots[slot];
+
+        if (!v.sample || v.sample->empty()) {
+            finished[n_finished++] = slot;
+            continue;
+        }
+
+        // Barramento L (ou mono) e, se for estéreo, R
+        float* outL = self->bus(v.bus);
+        float* outR = v.stereo ? self->bus(v.busR) : nullptr;
+        self->bus_active |= (1ull << v.bus) | (1ull << v.busR);
+
+        bool done;
+        if (v.fade_len) {
+            // Rampa de release (choke/roubo): mistura no buffer auxiliar e
+            // aplica o ganho decrescente ao somar nos barramentos
+            uint32_t n = std::min(n_frames, v.fade_left);
+            float* tmpL = self->fade_bufL.data();
+            float* tmpR = outR ? self->fade_bufR.data() : nullptr;
+            std::memset(tmpL, 0, n * sizeof(float));
+            if (tmpR) std::memset(tmpR, 0, n * sizeof(float));
+            mix_voice(self, slot, v, tmpL, tmpR, 0, n);
+
+            float step = 1.0f / (float)v.fade_len;
+            self->mix->ramp(outL + offset, tmpL, 0.0f, (float)v.fade_left, step, n);
+            if (tmpR) self->mix->ramp(outR + offset, tmpR, 0.0f, (float)v.fade_left, step, n);
+            v.fade_left -= n;
+            done = v.fade_left == 0 || v.pos >= v.length;
+        } else {
+            mix_voice(self, slot, v, outL, outR, offset, n_frames);
+            done = v.pos >= v.length;
+        }
+
+        if (done) finished[n_finished++] = slot;
+    }
+    for (int i = 0; i < n_finished; ++i) pool.release(finished[i]);
+}
+
+// Cria uma voz de `sample` no grupo com o ganho dado, sem roubar o slot
+// `keep`. Devolve o slot da voz (-1 se o sample estiver vazio ou não houver slot).
+static int start_voice(MyDrumKit* self, const RRGroup& group, const Sample* sample, float gain, int keep = -1) {
+    if (!sample || sample->empty()) return -1;
+
+    // Reserva a voz (rouba a mais silenciosa/antiga se o pool estiver cheio)
+    int slot = self->voices.start(group.chokeGroup, keep);
+    if (slot < 0) return -1;
+    Voice& v = self->voices.slots[slot];
+    v.sample = sample;
+    v.pos = 0;
+    v.bus = self->kit->bus_base + group.bus;
+    v.busR = self->kit->bus_base + group.busR;
+    v.stereo = sample->is_stereo && group.stereo;
+    v.velocity = gain;
+
+    // Golpes fracos chegam antes ao limiar de silêncio e liberam a voz mais cedo
+    v.length = sample->end_for(v.velocity);
+    std::atomic<uint64_t>& early = self->voices.early_frames;
+    early.store(early.load(std::memory_order_relaxed) + (sample->frames - v.length), std::memory_order_relaxed);
+
+    // Sample parcialmente residente: pede o restante à thread leitora
+    if (sample->streamed()) {
+        if (self->voices.streamer) {
+            v.streamed = true;
+            self->streamer.start(slot, sample);
+        } else {
+            v.length = std::min(v.length, sample->resident);
+        }
+    }
+    return slot;
+}
+
+// Dispara uma nota: a tabela de velocity dá a camada e o ganho (e, no
+// crossfade, a camada vizinha); cada camada avança o seu round robin
+static void note_on(MyDrumKit* self, RRGroup& group, uint8_t vel) {
+    // Choke: as vozes dos grupos cortados por esta nota entram em release
+    // (notas só com "cuts", sem samples, servem apenas para isso)
+    self->voices.choke(group.chokeMask);
+
+    const VelocityZone& z = group.zones[vel & 0x7F];
+    int first = start_voice(self, group, group.getNextSample(z.layer), z.gain);
+    // Com o pool cheio, a segunda camada não pode roubar a primeira
+    if (z.blend_gain > 0.0f) start_voice(self, group, group.getNextSample(z.blend), z.blend_gain, first);
+}
+
+// Acumula o custo do bloco e, ao fim de cada intervalo, publica a telemetria
+// na porta atom (se conectada). A sequência de saída é sempre reescrita.
+static void write_telemetry(MyDrumKit* self, uint32_t n_samples, double cost) {
+    Telemetry& t = self->telemetry;
+    double deadline = self->sample_rate ? (double)n_samples / self->sample_rate : 0.0;
+    float load = deadline > 0.0 ? (float)(cost / deadline) : 0.0f;
+
+    t.interval_frames += n_samples;
+    t.interval_cost += cost;
+    t.interval_deadline += deadline;
+    t.interval_worst = std::max(t.interval_worst, load);
+    t.note_voices((uint32_t)self->voices.size());
+    t.interval_active |= self->out_active;
+    t.total_frames.store(t.total_frames.load(std::memory_order_relaxed) + n_samples, std::memory_order_relaxed);
+    if (t.interval_peak > t.max_voices.load(std::memory_order_relaxed)) {
+        t.max_voices.store(t.interval_peak, std::memory_order_relaxed);
+    }
+    if (load > t.worst_load.load(std::memory_order_relaxed)) {
+        t.worst_load.store(load, std::memory_order_relaxed);
+    }
+
+    bool due = t.interval_frames >= t.period_frames;
+    LV2_Atom_Sequence* out = self->telemetry_out;
+    if (out) {
+        LV2_Atom_Forge* forge = &t.forge;
+        lv2_atom_forge_set_buffer(forge, (uint8_t*)out, out->atom.size);
+        LV2_Atom_Forge_Frame seq_frame;
+        if (lv2_atom_forge_sequence_head(forge, &seq_frame, 0)) {
+            // Kit em uso (resposta a patch:Get e aviso de troca de kit)
+            if (self->notify_kit) {
+                const std::string& path = self->kit->path;
+                LV2_Atom_Forge_Frame set_frame;
+                lv2_atom_forge_frame_time(forge, 0);
+                lv2_atom_forge_object(forge, &set_frame, 0, self->patch_set_urid);
+                lv2_atom_forge_key(forge, self->patch_property_urid);
+                lv2_atom_forge_urid(forge, self->kit_urid);
+                lv2_atom_forge_key(forge, self->patch_value_urid);
+                lv2_atom_forge_path(forge, path.c_str(), (uint32_t)path.size());
+                lv2_atom_forge_pop(forge, &set_frame);
+            }
+            if (due) {
+                LV2_Atom_Forge_Frame obj_frame;
+                lv2_atom_forge_frame_time(forge, 0);
+                lv2_atom_forge_object(forge, &obj_frame, 0, t.type);
+                lv2_atom_forge_key(forge, t.voices);
+                lv2_atom_forge_int(forge, self->voices.size());
+                lv2_atom_forge_key(forge, t.peak_voices);
+                lv2_atom_forge_int(forge, (int32_t)t.interval_peak);
+                lv2_atom_forge_key(forge, t.steals);
+                lv2_atom_forge_long(forge, (int64_t)self->voices.steals.load(std::memory_order_relaxed));
+                lv2_atom_forge_key(forge, t.chokes);
+                lv2_atom_forge_long(forge, (int64_t)self->voices.chokes.load(std::memory_order_relaxed));
+                lv2_atom_forge_key(forge, t.frames);
+                lv2_atom_forge_long(forge, (int64_t)t.total_frames.load(std::memory_order_relaxed));
+                lv2_atom_forge_key(forge, t.dsp_load);
+                lv2_atom_forge_float(forge, t.interval_deadline > 0.0 ? (float)(t.interval_cost / t.interval_deadline) : 0.0f);
+                lv2_atom_forge_key(forge, t.dsp_load_peak);
+                lv2_atom_forge_float(forge, t.interval_worst);
+                lv2_atom_forge_key(forge, t.underruns);
+                lv2_atom_forge_long(forge, (int64_t)self->streamer.underrun_count());
+                lv2_atom_forge_key(forge, t.active_outputs);
+                lv2_atom_forge_int(forge, (int32_t)t.interval_active);
+                lv2_atom_forge_pop(forge, &obj_frame);
+            }
+            lv2_atom_forge_pop(forge, &seq_frame);
+        }
+    }
+    self->notify_kit = false;
+
+    if (due) {
+        t.interval_frames = 0;
+        t.interval_peak = (uint32_t)self->voices.size();
+        t.interval_active = 0;
+        t.interval_cost = 0.0;
+        t.interval_deadline = 0.0;
+        t.interval_worst = 0.0f;
+    }
+}
+
+// Thread de áudio: entrega o kit antigo para ser liberado fora dela assim
+// que nenhuma voz disparada antes da troca estiver tocando
+static void retire_kit(MyDrumKit* self) {
+    const VoicePool& pool = self->voices;
+    for (int slot : pool.active) {
+        if (pool.slots[slot].serial < self->retired_serial) return;
+    }
+    if (self->schedule) {
+        WorkMessage msg = { WORK_FREE_KIT, self->retired };
+        if (self->schedule->schedule_work(self->schedule->handle, sizeof(msg), &msg) != LV2_WORKER_SUCCESS) return;
+    } else {
+        // Sem worker: liberado na próxima troca ou no cleanup
+        Kit* expected = nullptr;
+        if (!self->garbage.compare_exchange_strong(expected, self->retired, std::memory_order_release)) return;
+    }
+    self->retired = nullptr;
+}
+
+// patch:Get/patch:Set da propriedade <#kit> na entrada MIDI (thread de
+// áudio). A troca vai para o worker com o caminho na própria mensagem; sem
+// worker do host, só o estado (restore) troca o kit.
+static void handle_patch(MyDrumKit* self, const LV2_Atom_Object* obj) {
+    if (obj->body.otype == self->patch_get_urid) {
+        self->notify_kit = true;
+        return;
+    }
+    if (obj->body.otype != self->patch_set_urid || !self->schedule) return;
+
+    const LV2_Atom* property = nullptr;
+    const LV2_Atom* value = nullptr;
+    lv2_atom_object_get(obj, self->patch_property_urid, &property, self->patch_value_urid, &value, 0);
+    if (!property || property->type != self->atom_urid_urid ||
+        ((const LV2_Atom_URID*)property)->body != self->kit_urid) return;
+    if (!value || value->type != self->atom_path_urid || value->size == 0 || value->size >= PATH_MAX) return;
+
+    uint8_t buf[sizeof(WorkMessage) + PATH_MAX];
+    WorkMessage msg = { WORK_SET_KIT, nullptr };
+    std::memcpy(buf, &msg, sizeof(msg));
+    std::memcpy(buf + sizeof(msg), LV2_ATOM_BODY_CONST(value), value->size);
+    buf[sizeof(msg) + value->size] = '\0';
+    self->schedule->schedule_work(self->schedule->handle, (uint32_t)(sizeof(msg) + value->size + 1), buf);
+}
 
-    // Limpa os buffers de saída
+// Mistura os barramentos com som nas saídas, a partir do frame `base` do
+// bloco: a matriz do kit e, durante uma troca, a do kit antigo. Os níveis
+// que mudaram seguem uma rampa linear ao longo do trecho.
+static void mix_buses(MyDrumKit* self, uint32_t base, uint32_t n) {
+    float from[NUM_OUTPUTS], to[NUM_OUTPUTS];
     for (int i = 0; i < NUM_OUTPUTS; ++i) {
-        if (self->outputs[i])
-            std::memset(self->outputs[i], 0, sizeof(float) * n_samples);
+        from[i] = self->out_gain[i].gain;
+        to[i] = self->out_gain[i].advance(n);
+    }
+    float bleed_from = self->bleed_gain.gain;
+    float bleed_to = self->bleed_gain.advance(n);
+
+    uint64_t active = self->bus_active;
+    if (!active) return;
+    for (const Kit* kit : { self->kit, self->retired }) {
+        if (!kit) continue;
+        for (const BusSend& s : kit->sends) {
+            int b = kit->bus_base + s.bus;
+            float* out = self->outputs[s.output];
+            if (!(active & (1ull << b)) || !out) continue;
+
+            float g0 = s.gain * from[s.output];
+            float g1 = s.gain * to[s.output];
+            if (s.bleed) {
+                g0 *= bleed_from;
+                g1 *= bleed_to;
+            }
+            if (g0 == g1) {
+                if (g1 == 0.0f) continue;
+                self->mix->mono(out + base, self->bus(b), g1, n);
+            } else {
+                self->mix->ramp(out + base, self->bus(b), g1, (float)n, (g0 - g1) / (float)n, n);
+            }
+            self->out_active |= 1u << s.output;
+        }
+    }
+
+    // Deixa os barramentos usados zerados para o próximo trecho
+    for (uint64_t m = active; m; m &= m - 1) {
+        std::memset(self->bus(__builtin_ctzll(m)), 0, n * sizeof(float));
     }
+    self->bus_active = 0;
+}
+
+// Processa o trecho [base, base + n) do bloco (n <= BUS_FRAMES): eventos,
+// vozes nos barramentos e matriz de saídas. Cada evento é tratado no trecho
+// do seu frame; os de antes do bloco no primeiro e os de depois no último.
+static void run_span(MyDrumKit* self, uint32_t base, uint32_t n, bool last) {
+    uint32_t cursor = 0;  // primeiro frame do trecho ainda não renderizado
 
     // Processa os eventos MIDI
     if (self->midi_in && self->midi_event_urid != 0) {
         LV2_ATOM_SEQUENCE_FOREACH(self->midi_in, ev) {
+            int64_t t = ev->time.frames - (int64_t)base;
+            if ((base > 0 && t < 0) || (!last && t >= (int64_t)n)) continue;
+
+            // Eventos fora de ordem ou além do bloco são presos ao intervalo válido
+            uint32_t frame = t < (int64_t)cursor ? cursor
+                           : t > (int64_t)n ? n
+                           : (uint32_t)t;
+
             if (ev->body.type == self->midi_event_urid) {
                 const uint8_t* msg = (const uint8_t*)(ev + 1);
-                if (!msg) continue;
+                if (!msg || ev->body.size < 3) continue;
 
                 uint8_t status = msg[0] & 0xF0;
                 uint8_t note   = msg[1];
                 uint8_t vel    = msg[2];
 
                 if (status == 0x90 && vel > 0) { // NOTE ON
-                    auto it = self->rr_groups.find(note);
-                    if (it != self->rr_groups.end()) {
-                        RRGroup& group = it->second;
-                        const Sample* sample = group.getNextSample();
-
-                        if (sample && !sample->dataL.empty()) {
-                            // Choke: remove vozes do mesmo grupo, se houver
-                            if (group.chokeGroup > 0) {
-                                self->voices.erase(
-                                    std::remove_if(self->voices.begin(), self->voices.end(),
-                                        [&](const Voice& existing) {
-                                            return existing.chokeGroup == group.chokeGroup;
-                                        }),
-                                    self->voices.end());
-                            }
-
-                            Voice v;
-                            v.sample = sample;
-                            v.pos = 0;
-                            v.length = sample->dataL.size();
-                            v.output = group.output;
-                            v.chokeGroup = group.chokeGroup;
-                            float v_norm = (float)vel / 127.0f;
-                            v.velocity = v_norm * v_norm;
-                            if (v.velocity < 0.0f) v.velocity = 0.0f;
-                            if (v.velocity > 1.0f) v.velocity = 1.0f;
-
-                            self->voices.push_back(v);
-
-                            // Limite simples de vozes
-                            if (self->voices.size() > MAX_VOICES) {
-                                self->voices.erase(self->voices.begin());
-                            }
-                        }
+                    RRGroup* group = self->kit->note_table[note & 0x7F];
+                    // Notas cujo grupo ainda não terminou de carregar são ignoradas
+                    if (group && group->ready.load(std::memory_order_acquire)) {
+                        // Renderiza até o frame do evento antes de iniciar a nova voz
+                        render_voices(self, cursor, frame - cursor);
+                        cursor = frame;
+
+                        note_on(self, *group, vel);
+                        self->telemetry.note_voices((uint32_t)self->voices.size());
+                    }
+                } else if (status == 0xA0 && vel > 0) { // AFTERTOUCH POLIFÔNICO: prato agarrado
+                    RRGroup* group = self->kit->note_table[note & 0x7F];
+                    if (group && group->chokeGroup > 0) {
+                        render_voices(self, cursor, frame - cursor);
+                        cursor = frame;
+                        self->voices.choke(1u << group->chokeGroup);
                     }
                 }
 
                 // (Opcional) implementar NOTE OFF caso queira cortar vozes por nota específica.
+            } else if (ev->body.type == self->atom_object_urid) {
+                handle_patch(self, (const LV2_Atom_Object*)&ev->body);
             }
         }
     }
 
-    // Renderiza o áudio: percorre vozes e mistura
-    for (auto it = self->voices.begin(); it != self->voices.end();) {
-        auto& v = *it;
+    // Renderiza o restante do trecho e mistura nas saídas
+    render_voices(self, cursor, n - cursor);
+    mix_buses(self, base, n);
+}
 
-        if (!v.sample || v.sample->dataL.empty()) {
-            it = self->voices.erase(it);
-            continue;
+// Execução (processamento de áudio e MIDI)
+//
+// O bloco é renderizado em sub-blocos divididos no frame de cada NOTE ON
+// (ev->time.frames), para que a voz comece exatamente no sample pedido pelo
+// host. Eventos no mesmo frame (ou que não disparam voz) não geram divisão.
+// As vozes tocam nos barramentos internos e a matriz de saídas é aplicada ao
+// fim de cada trecho (ver run_span).
+static void run(LV2_Handle instance, uint32_t n_samples) {
+    MyDrumKit* self = (MyDrumKit*)instance;
+    if (!self) return;
+    auto t0 = std::chrono::steady_clock::now();
+
+    // Agenda o carregamento dos samples no worker do host (primeiro run). Se o
+    // host restaurou um estado antes, carrega direto o kit pedido (o kit
+    // inicial só é carregado se a troca falhar).
+    if (self->schedule && !self->load_scheduled) {
+        bool restore = self->restore_pending.exchange(false, std::memory_order_acquire);
+        WorkMessage msg = { restore ? WORK_RESTORE_KIT : WORK_LOAD_SAMPLES, self->kit };
+        if (self->schedule->schedule_work(self->schedule->handle, sizeof(msg), &msg) == LV2_WORKER_SUCCESS) {
+            self->load_scheduled = true;
+        } else if (restore) {
+            self->restore_pending.store(true, std::memory_order_relaxed);
         }
-
-        const float* dataL = v.sample->dataL.data();
-        const float* dataR = v.sample->is_stereo ? v.sample->dataR.data() : nullptr;
-
-        if (!dataL) {
-            it = self->voices.erase(it);
-            continue;
+    } else if (self->schedule && self->restore_pending.load(std::memory_order_relaxed)) {
+        self->restore_pending.store(false, std::memory_order_relaxed);
+        WorkMessage msg = { WORK_RESTORE_KIT, nullptr };
+        if (self->schedule->schedule_work(self->schedule->handle, sizeof(msg), &msg) != LV2_WORKER_SUCCESS) {
+            self->restore_pending.store(true, std::memory_order_relaxed);
         }
+    }
 
-        for (uint32_t i = 0; i < n_samples && v.pos < v.length; ++i) {
-            // Renderiza canal L (ou mono)
-            if (v.output >= 0 && v.output < NUM_OUTPUTS && self->outputs[v.output]) {
-                self->outputs[v.output][i] += dataL[v.pos] * v.velocity;
-            }
-
-            // Se for estéreo, renderiza canal R na próxima saída (verifica bounds)
-            if (dataR && v.output >= 0 && (v.output + 1) < NUM_OUTPUTS && self->outputs[v.output + 1]) {
-                self->outputs[v.output + 1][i] += dataR[v.pos] * v.velocity;
-            }
+    // Troca de kit: o novo entra entre dois blocos; o antigo espera as suas vozes
+    if (!self->retired && self->next_kit.load(std::memory_order_relaxed)) {
+        self->retired = self->kit;
+        self->kit = self->next_kit.exchange(nullptr, std::memory_order_acquire);
+        self->kit->bus_base = self->retired->bus_base ^ MAX_BUSES;  // outro banco de barramentos
+        self->retired_serial = self->voices.next_serial;
+        self->notify_kit = true;
+    }
+    if (self->retired) retire_kit(self);
+
+    // Informa o progresso do carregamento ao host (100 só quando todo o trabalho terminou)
+    if (self->progress) {
+        uint32_t total = self->files_total.load(std::memory_order_relaxed);
+        uint32_t done = self->files_loaded.load(std::memory_order_relaxed);
+        *self->progress = self->load_done.load(std::memory_order_relaxed)
+                        ? 100.0f
+                        : std::min(99.0f, total ? 100.0f * (float)done / (float)total : 0.0f);
+    }
 
-            v.pos++;
-        }
+    // Níveis das saídas e do bleed (portas opcionais; sem conexão = 0 dB)
+    for (int i = 0; i < NUM_OUTPUTS; ++i) {
+        if (self->gain_ports[i]) self->out_gain[i].set_db(*self->gain_ports[i], self->smooth_frames);
+    }
+    if (self->bleed_port) self->bleed_gain.set_db(*self->bleed_port, self->smooth_frames);
 
-        if (v.pos >= v.length)
-            it = self->voices.erase(it);
-        else
-            ++it;
+    // Limpa os buffers de saída. No modo esparso, uma saída em silêncio é
+    // zerada uma vez e depois deixada como está até voltar a ter som.
+    for (int i = 0; i < NUM_OUTPUTS; ++i) {
+        if (!self->outputs[i] || self->out_zeroed[i] >= n_samples) continue;
+        std::memset(self->outputs[i], 0, sizeof(float) * n_samples);
+        if (self->sparse_outputs) self->out_zeroed[i] = n_samples;
+    }
+    self->out_active = 0;
+
+    // Blocos maiores que os barramentos são processados em trechos (um
+    // trecho vazio se n_samples = 0, para os eventos ainda serem tratados)
+    uint32_t base = 0;
+    do {
+        uint32_t n = std::min<uint32_t>(BUS_FRAMES, n_samples - base);
+        run_span(self, base, n, base + n == n_samples);
+        base += n;
+    } while (base < n_samples);
+
+    // Saídas escritas precisam ser zeradas de novo no próximo bloco
+    for (uint32_t m = self->out_active; m; m &= m - 1) {
+        self->out_zeroed[__builtin_ctz(m)] = 0;
     }
+    if (self->activity) *self->activity = (float)self->out_active;
+
+    if (self->stream_ms) self->streamer.flush();
+
+    double cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    write_telemetry(self, n_samples, cost);
 }
 
 // Limpeza de memória
@@ -522,9 +3465,193 @@ static void cleanup(LV2_Handle instance) {
     if (!self) return;
 
     fprintf(stderr, "MyDrumKit: Limpando plugin\n");
+    const Telemetry& t = self->telemetry;
+    if (t.total_frames.load() > 0) {
+        fprintf(stderr, "MyDrumKit: Telemetria: %llu frames, pico de %u vozes, %llu roubos, %llu chokes, "
+                "pior bloco %.0f%% do prazo, %llu frames de voz poupados pelo fim antecipado\n",
+                (unsigned long long)t.total_frames.load(), t.max_voices.load(),
+                (unsigned long long)self->voices.steals.load(), (unsigned long long)self->voices.chokes.load(),
+                100.0 * t.worst_load.load(), (unsigned long long)self->voices.early_frames.load());
+    }
+
+    // Interrompe o carregamento em andamento
+    self->abort_load.store(true);
+    if (self->loader.joinable()) {
+        self->loader.join();
+    }
+    // O host não deveria chamar cleanup() durante work(), mas por segurança espera
+    while (self->loading.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
     delete self;
 }
 
+// Worker: carga, troca e liberação de kits fora da thread de áudio
+static LV2_Worker_Status work(LV2_Handle instance,
+                              LV2_Worker_Respond_Function,
+                              LV2_Worker_Respond_Handle,
+                              uint32_t size,
+                              const void* data) {
+    MyDrumKit* self = (MyDrumKit*)instance;
+    if (!self || size < sizeof(WorkMessage)) return LV2_WORKER_ERR_UNKNOWN;
+
+    // `loading` cobre o item inteiro: switch_kit() ainda usa `self` depois
+    // do load_samples(), e o cleanup() espera por ele
+    self->loading.store(true);
+    const WorkMessage* msg = (const WorkMessage*)data;
+    if (msg->type == WORK_LOAD_SAMPLES) {
+        load_samples(self, msg->kit);
+    } else if (msg->type == WORK_SET_KIT) {
+        const char* text = (const char*)data + sizeof(WorkMessage);
+        std::string path(text, strnlen(text, size - sizeof(WorkMessage)));
+        {
+            std::lock_guard<std::mutex> lock(self->kit_mutex);
+            self->kit_requested = path;
+        }
+        switch_kit(self, path);
+    } else if (msg->type == WORK_RESTORE_KIT) {
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(self->kit_mutex);
+            path = self->kit_requested;
+        }
+        if (!switch_kit(self, path) && msg->kit) load_samples(self, msg->kit);
+    } else if (msg->type == WORK_FREE_KIT) {
+        free_kit(self, msg->kit);
+    }
+    self->loading.store(false);
+    return LV2_WORKER_SUCCESS;
+}
+
+// Resposta do worker (thread de áudio): os grupos já são publicados pelo próprio carregamento
+static LV2_Worker_Status work_response(LV2_Handle, uint32_t, const void*) {
+    return LV2_WORKER_SUCCESS;
+}
+
+// Busca uma feature do host pela URI (nullptr se ausente)
+static const void* find_feature(const LV2_Feature* const* features, const char* uri) {
+    for (const LV2_Feature* const* f = features; f && *f; ++f) {
+        if (!strcmp((*f)->URI, uri)) return (*f)->data;
+    }
+    return nullptr;
+}
+
+// Caminho devolvido pelo mapPath do host
+static void free_state_path(const LV2_Feature* const* features, char* path) {
+    const LV2_State_Free_Path* free_path = (const LV2_State_Free_Path*)find_feature(features, LV2_STATE__freePath);
+    if (free_path) free_path->free_path(free_path->handle, path);
+    else free(path);
+}
+
+// LV2 State: salva o kit escolhido (caminho abstrato, se o host mapeia caminhos)
+static LV2_State_Status save(LV2_Handle instance, LV2_State_Store_Function store, LV2_State_Handle handle,
+                             uint32_t, const LV2_Feature* const* features) {
+    MyDrumKit* self = (MyDrumKit*)instance;
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(self->kit_mutex);
+        path = self->kit_selected;
+    }
+
+    const LV2_State_Map_Path* map_path = (const LV2_State_Map_Path*)find_feature(features, LV2_STATE__mapPath);
+    char* mapped = map_path ? map_path->abstract_path(map_path->handle, path.c_str()) : nullptr;
+    const char* value = mapped ? mapped : path.c_str();
+    LV2_State_Status status = store(handle, self->kit_urid, value, strlen(value) + 1, self->atom_path_urid,
+                                    LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+    if (mapped) free_state_path(features, mapped);
+    return status;
+}
+
+// LV2 State: pede a troca para o kit salvo (sem propriedade, mantém o atual).
+// A carga acontece em segundo plano; o kit atual toca até o novo ficar pronto.
+static LV2_State_Status restore(LV2_Handle instance, LV2_State_Retrieve_Function retrieve, LV2_State_Handle handle,
+                                uint32_t, const LV2_Feature* const* features) {
+    MyDrumKit* self = (MyDrumKit*)instance;
+    size_t size = 0;
+    uint32_t type = 0, value_flags = 0;
+    const char* value = (const char*)retrieve(handle, self->kit_urid, &size, &type, &value_flags);
+    if (!value || size == 0) return LV2_STATE_SUCCESS;
+    if (type != self->atom_path_urid) return LV2_STATE_ERR_BAD_TYPE;
+
+    std::string stored(value, strnlen(value, size));
+    const LV2_State_Map_Path* map_path = (const LV2_State_Map_Path*)find_feature(features, LV2_STATE__mapPath);
+    std::string path = stored;
+    if (map_path) {
+        if (char* absolute = map_path->absolute_path(map_path->handle, stored.c_str())) {
+            path = absolute;
+            free_state_path(features, absolute);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(self->kit_mutex);
+        if (path == self->kit_requested) return LV2_STATE_SUCCESS;
+    }
+    fprintf(stderr, "MyDrumKit: Estado restaurado: kit %s\n", path.c_str());
+    request_kit(self, path);
+    return LV2_STATE_SUCCESS;
+}
+
+static const void* extension_data(const char* uri) {
+    static const LV2_Worker_Interface worker = { work, work_response, nullptr };
+    static const LV2_State_Interface state = { save, restore };
+    if (!strcmp(uri, LV2_WORKER__interface)) {
+        return &worker;
+    }
+    if (!strcmp(uri, LV2_STATE__interface)) {
+        return &state;
+    }
+    return nullptr;
+}
+
+#ifdef MYDRUMKIT_BENCH
+// Ganchos para tools/bench.cpp, tools/render.cpp e tools/kitcache.cpp
+// (compilados só nas ferramentas, não existem no plugin)
+extern "C" uint32_t mydrumkit_bench_active_voices(LV2_Handle instance) {
+    return (uint32_t)((MyDrumKit*)instance)->voices.size();
+}
+
+// Bytes dos samples residentes do kit (cada sample contado uma vez)
+extern "C" uint64_t mydrumkit_bench_sample_bytes(LV2_Handle instance) {
+    MyDrumKit* self = (MyDrumKit*)instance;
+    std::set<const Sample*> unique;
+    for (const auto& g : self->kit->groups) {
+        for (const auto& sp : g->samples) unique.insert(sp.get());
+    }
+    uint64_t bytes = 0;
+    for (const Sample* sp : unique) bytes += (uint64_t)sp->resident * sp->frame_bytes();
+    return bytes;
+}
+
+// Maior sample do kit, em frames: a cauda mais longa que uma voz pode ter
+extern "C" uint32_t mydrumkit_bench_max_sample_frames(LV2_Handle instance) {
+    MyDrumKit* self = (MyDrumKit*)instance;
+    uint32_t frames = 0;
+    for (const auto& g : self->kit->groups) {
+        for (const auto& sp : g->samples) frames = std::max(frames, sp->frames);
+    }
+    return frames;
+}
+
+// Caminho do cache de kit da instância em `buf` (vazio sem diretório de cache)
+extern "C" void mydrumkit_bench_cache_path(LV2_Handle instance, char* buf, size_t size) {
+    MyDrumKit* self = (MyDrumKit*)instance;
+    std::string path = kit_cache_path(self->kit->path, self->sample_rate, self->storage);
+    snprintf(buf, size, "%s", path.c_str());
+}
+
+// Avança o round robin de uma nota como um NOTE ON, sem disparar voz (o
+// render em segmentos reproduz assim as notas anteriores ao segmento)
+extern "C" void mydrumkit_bench_skip_note(LV2_Handle instance, uint8_t note, uint8_t vel) {
+    RRGroup* group = ((MyDrumKit*)instance)->kit->note_table[note & 0x7F];
+    if (!group || !group->ready.load(std::memory_order_acquire)) return;
+    const VelocityZone& z = group->zones[vel & 0x7F];
+    group->getNextSample(z.layer);
+    if (z.blend_gain > 0.0f) group->getNextSample(z.blend);
+}
+#endif
+
 // Descritor do plugin
 static const LV2_Descriptor descriptor = {
     MYDRUMKIT_URI,
@@ -534,7 +3661,7 @@ static const LV2_Descriptor descriptor = {
     run,
     nullptr,     // deactivate
     cleanup,
-    nullptr      // extension_data
+    extension_data
 };
 
 // Função principal de exportação
@@ -0,0 +1,692 @@
+// mydrumkit-bench: benchmark e teste de regressão do run().
+//
+// Host sem interface que carrega o plugin pelo descritor LV2 e toca padrões
+// MIDI sintéticos e determinísticos:
+//
+//   blast   blast beat (bumbo/caixa alternados em semicolcheias, ride e crash)
+//   swell   rulos de pratos com velocidade crescente (vozes estéreo longas)
+//   stress  uma nota a cada 2 ms em todo o kit (pool de vozes cheio, roubo)
+//   idle    um bumbo a cada 2 s (instância quase sempre sem vozes; com
+//           MYDRUMKIT_SPARSE=1 mede o custo das saídas em silêncio)
+//
+// Para cada cenário, tamanho de bloco, kernel de mixagem e formato dos
+// samples, mede ns por frame, ns por voz·frame, o pior bloco, o tempo de
+// instanciação/carga e a memória ocupada pelos samples.
+//
+// A saída pode ser gravada como referência (--golden-write) e comparada
+// depois (--golden), para provar que uma otimização é idêntica bit a bit
+// (tolerância 0, o padrão) ou fica dentro de --tol. A referência completa é
+// grande demais para o repositório; o que fica versionado são as somas
+// (FNV-1a de 64 bits) da saída de cada cenário, em bench-golden.sum
+// (--sum-write / --sum), que só aceitam saída idêntica bit a bit.
+//
+// Uso: mydrumkit-bench <bundle> [opções]
+//   -b 64,256,1024      tamanhos de bloco (padrão 256)
+//   -r 44100            taxa de amostragem
+//   -s blast,swell      cenários (padrão: todos)
+//   -t 6                duração de cada cenário em segundos
+//   --simd              repete com cada kernel de mixagem (escalar, SSE, AVX2)
+//   --storage           repete com cada formato de sample (float, int16)
+//   --golden ARQ        compara a saída com a referência
+//   --golden-write ARQ  grava a referência
+//   --sum ARQ           compara as somas da saída com as gravadas
+//   --sum-write ARQ     grava as somas da saída
+//   --tol X             diferença máxima aceita na comparação
+//   --realtime          chama o run() no ritmo do relógio, como um host real
+//                       (necessário com MYDRUMKIT_STREAM_MS, senão a thread
+//                       leitora não acompanha e há underruns)
+
+#include <lv2/core/lv2.h>
+#include <lv2/atom/atom.h>
+#include <lv2/midi/midi.h>
+#include <lv2/urid/urid.h>
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#define NUM_OUTPUTS 12
+#define PORT_PROGRESS (NUM_OUTPUTS + 1)
+#define GOLDEN_MAGIC "MDKGOLD1"
+
+extern "C" uint32_t mydrumkit_bench_active_voices(LV2_Handle instance);
+extern "C" uint64_t mydrumkit_bench_sample_bytes(LV2_Handle instance);
+
+typedef std::chrono::steady_clock Clock;
+
+static std::vector<std::string> uris;
+static bool realtime = false;
+
+static LV2_URID map_uri(LV2_URID_Map_Handle, const char* uri) {
+    for (size_t i = 0; i < uris.size(); ++i) {
+        if (uris[i] == uri) return (LV2_URID)(i + 1);
+    }
+    uris.push_back(uri);
+    return (LV2_URID)uris.size();
+}
+
+static double ms_since(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// ---------------------------------------------------------------------------
+// Cenários
+
+struct NoteEvent {
+    uint64_t frame;
+    uint8_t note;
+    uint8_t vel;
+};
+
+// Gerador pseudoaleatório fixo, para que os cenários sejam sempre iguais
+struct Lcg {
+    uint32_t state;
+    explicit Lcg(uint32_t seed) : state(seed) {}
+    uint32_t next() {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    }
+    uint8_t vel(int lo, int hi) { return (uint8_t)(lo + next() % (hi - lo + 1)); }
+};
+
+static void sort_events(std::vector<NoteEvent>& ev) {
+    std::stable_sort(ev.begin(), ev.end(), [](const NoteEvent& a, const NoteEvent& b) { return a.frame < b.frame; });
+}
+
+static std::vector<NoteEvent> make_blast(double rate, double seconds) {
+    std::vector<NoteEvent> ev;
+    Lcg rnd(1);
+    double step = 60.0 / 200.0 / 4.0;  // semicolcheias a 200 bpm
+    int n_steps = (int)(seconds / step);
+    for (int i = 0; i < n_steps; ++i) {
+        uint64_t f = (uint64_t)(i * step * rate);
+        ev.push_back({f, (uint8_t)(i % 2 ? 38 : 36), rnd.vel(95, 127)});
+        ev.push_back({f, 51, rnd.vel(70, 110)});
+        if (i % 16 == 0) ev.push_back({f, 49, rnd.vel(100, 127)});
+    }
+    sort_events(ev);
+    return ev;
+}
+
+static std::vector<NoteEvent> make_swell(double rate, double seconds) {
+    static const uint8_t cymbals[] = { 49, 57 };  // rulo nos dois crashes
+    std::vector<NoteEvent> ev;
+    Lcg rnd(2);
+    double swell = 3.0;   // cada rulo cresce por 3 s e termina em um acento
+    double step = 0.040;
+    int n_steps = (int)(seconds / step);
+    for (int i = 0; i < n_steps; ++i) {
+        double t = i * step;
+        double phase = fmod(t, swell) / swell;
+        uint64_t f = (uint64_t)(t * rate);
+        ev.push_back({f, cymbals[i % 2], (uint8_t)std::min(127.0, 20 + phase * 100 + rnd.next() % 8)});
+        if (i % (int)(swell / step) == 0 && i > 0) {
+            ev.push_back({f, 55, 127});
+            ev.push_back({f, 36, 127});
+        }
+    }
+    sort_events(ev);
+    return ev;
+}
+
+static std::vector<NoteEvent> make_stress(double rate, double seconds) {
+    static const uint8_t notes[] = { 49, 57, 51, 53, 59, 52, 55, 50, 48, 47, 45, 43, 41,
+                                     36, 37, 38, 40, 39, 42, 46, 44 };
+    std::vector<NoteEvent> ev;
+    Lcg rnd(3);
+    double step = 0.002;
+    int n_steps = (int)(seconds / step);
+    for (int i = 0; i < n_steps; ++i) {
+        ev.push_back({(uint64_t)(i * step * rate), notes[i % (sizeof(notes) / sizeof(notes[0]))], rnd.vel(60, 127)});
+    }
+    return ev;
+}
+
+static std::vector<NoteEvent> make_idle(double rate, double seconds) {
+    std::vector<NoteEvent> ev;
+    for (double t = 0.0; t < seconds; t += 2.0) ev.push_back({(uint64_t)(t * rate), 36, 100});
+    return ev;
+}
+
+struct Scenario {
+    const char* name;
+    std::vector<NoteEvent> (*make)(double rate, double seconds);
+};
+
+static const Scenario SCENARIOS[] = {
+    { "blast", make_blast },
+    { "swell", make_swell },
+    { "stress", make_stress },
+    { "idle", make_idle },
+};
+
+// ---------------------------------------------------------------------------
+// Instância do plugin
+
+struct Instance {
+    const LV2_Descriptor* desc;
+    LV2_Handle handle;
+    uint32_t block;
+    double rate;
+    std::vector<float> audio;
+    std::vector<uint64_t> seq_buf;
+    float progress;
+    double instantiate_ms;  // chamada instantiate()
+    double load_ms;         // até a porta de progresso chegar a 100
+
+    Instance() : desc(nullptr), handle(nullptr), block(0), rate(0.0), progress(0.0f), instantiate_ms(0.0), load_ms(0.0) {}
+    ~Instance() { close(); }
+
+    bool open(const LV2_Descriptor* d, const char* bundle, const LV2_Feature* const* features,
+              double sample_rate, uint32_t block_size) {
+        desc = d;
+        block = block_size;
+        rate = sample_rate;
+        audio.assign((size_t)block * NUM_OUTPUTS, 0.0f);
+
+        auto t0 = Clock::now();
+        handle = desc->instantiate(desc, sample_rate, bundle, features);
+        instantiate_ms = ms_since(t0);
+        if (!handle) return false;
+
+        set_events(nullptr, 0, 0);
+        desc->connect_port(handle, 0, seq_buf.data());
+        for (int i = 0; i < NUM_OUTPUTS; ++i) desc->connect_port(handle, 1 + i, &audio[i * block]);
+        desc->connect_port(handle, PORT_PROGRESS, &progress);
+        if (desc->activate) desc->activate(handle);
+
+        while (progress < 100.0f) {
+            desc->run(handle, block);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        load_ms = ms_since(t0);
+        return true;
+    }
+
+    void close() {
+        if (!handle) return;
+        if (desc->deactivate) desc->deactivate(handle);
+        desc->cleanup(handle);
+        handle = nullptr;
+    }
+
+    // Monta a sequência MIDI do bloco que começa em `start` com os eventos [ev, ev + n)
+    void set_events(const NoteEvent* ev, size_t n, uint64_t start) {
+        struct MidiEvent {
+            LV2_Atom_Event ev;
+            uint8_t msg[8];
+        };
+        size_t words = (sizeof(LV2_Atom_Sequence) + n * sizeof(MidiEvent)) / sizeof(uint64_t) + 1;
+        if (seq_buf.size() < words) {
+            seq_buf.resize(std::max<size_t>(words, 64));
+            if (handle) desc->connect_port(handle, 0, seq_buf.data());
+        }
+
+        LV2_Atom_Sequence* seq = (LV2_Atom_Sequence*)seq_buf.data();
+        seq->atom.type = map_uri(nullptr, LV2_ATOM__Sequence);
+        seq->atom.size = sizeof(LV2_Atom_Sequence_Body);
+        seq->body.unit = 0;
+        seq->body.pad = 0;
+        MidiEvent* out = (MidiEvent*)LV2_ATOM_CONTENTS(LV2_Atom_Sequence, seq);
+        LV2_URID midi_type = map_uri(nullptr, LV2_MIDI__MidiEvent);
+        for (size_t i = 0; i < n; ++i, ++out) {
+            std::memset(out, 0, sizeof(*out));
+            out->ev.time.frames = (int64_t)(ev[i].frame - start);
+            out->ev.body.type = midi_type;
+            out->ev.body.size = 3;
+            out->msg[0] = LV2_MIDI_MSG_NOTE_ON | 9;
+            out->msg[1] = ev[i].note;
+            out->msg[2] = ev[i].vel;
+            seq->atom.size += sizeof(MidiEvent);
+        }
+    }
+};
+
+struct Stats {
+    double run_ns;        // tempo total dentro do run()
+    double voice_frames;  // vozes ativas x frames (média entre o início e o fim de cada bloco)
+    double worst_ns;      // pior bloco
+    uint64_t frames;
+
+    Stats() : run_ns(0.0), voice_frames(0.0), worst_ns(0.0), frames(0) {}
+};
+
+// Toca um cenário. Se `capture` não é nulo, guarda a saída (planar, canal a canal).
+static Stats play(Instance& inst, const std::vector<NoteEvent>& events, uint64_t total_frames,
+                  std::vector<float>* capture) {
+    Stats st;
+    if (capture) capture->assign(total_frames * NUM_OUTPUTS, 0.0f);
+
+    size_t next = 0;
+    uint32_t voices = mydrumkit_bench_active_voices(inst.handle);
+    auto begin = Clock::now();
+    for (uint64_t start = 0; start < total_frames; start += inst.block) {
+        if (realtime) {
+            std::this_thread::sleep_until(begin + std::chrono::nanoseconds((int64_t)(start * 1e9 / inst.rate)));
+        }
+        uint32_t n = (uint32_t)std::min<uint64_t>(inst.block, total_frames - start);
+        size_t first = next;
+        while (next < events.size() && events[next].frame < start + n) ++next;
+        inst.set_events(events.data() + first, next - first, start);
+
+        auto t0 = Clock::now();
+        inst.desc->run(inst.handle, n);
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+
+        uint32_t after = mydrumkit_bench_active_voices(inst.handle);
+        st.run_ns += ns;
+        st.worst_ns = std::max(st.worst_ns, ns);
+        st.voice_frames += 0.5 * (voices + after) * n;
+        st.frames += n;
+        voices = after;
+
+        if (capture) {
+            for (int c = 0; c < NUM_OUTPUTS; ++c) {
+                std::memcpy(&(*capture)[c * total_frames + start], &inst.audio[c * inst.block], n * sizeof(float));
+            }
+        }
+    }
+    return st;
+}
+
+// ---------------------------------------------------------------------------
+// Referência (golden): cabeçalho, e por cenário o nome, os frames e a saída planar
+
+struct GoldenHeader {
+    char magic[8];
+    double rate;
+    double seconds;
+    uint32_t block;
+    uint32_t n_scenarios;
+};
+
+struct GoldenScenario {
+    char name[16];
+    uint64_t frames;
+};
+
+static const Scenario* find_scenario(const char* name) {
+    for (const Scenario& s : SCENARIOS) {
+        if (!strcmp(s.name, name)) return &s;
+    }
+    return nullptr;
+}
+
+// MYDRUMKIT_SIMD / MYDRUMKIT_STORAGE do ambiente, restaurados após as
+// variantes para que a referência use a configuração pedida pelo usuário
+static const char* env_simd = nullptr;
+static const char* env_storage = nullptr;
+
+static void set_simd(const char* simd) {
+    if (simd) setenv("MYDRUMKIT_SIMD", simd, 1);
+    else unsetenv("MYDRUMKIT_SIMD");
+}
+
+static void set_storage(const char* storage) {
+    if (storage) setenv("MYDRUMKIT_STORAGE", storage, 1);
+    else unsetenv("MYDRUMKIT_STORAGE");
+}
+
+static bool golden_write(const char* path, const LV2_Descriptor* desc, const char* bundle,
+                         const LV2_Feature* const* features, const std::vector<const Scenario*>& scenarios,
+                         double rate, double seconds, uint32_t block) {
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "mydrumkit-bench: não foi possível criar %s\n", path);
+        return false;
+    }
+    GoldenHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, GOLDEN_MAGIC, 8);
+    h.rate = rate;
+    h.seconds = seconds;
+    h.block = block;
+    h.n_scenarios = (uint32_t)scenarios.size();
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+
+    for (const Scenario* sc : scenarios) {
+        Instance inst;
+        if (!inst.open(desc, bundle, features, rate, block)) {
+            ok = false;
+            break;
+        }
+        uint64_t frames = (uint64_t)(seconds * rate);
+        std::vector<float> out;
+        play(inst, sc->make(rate, seconds), frames, &out);
+
+        GoldenScenario gs;
+        std::memset(&gs, 0, sizeof(gs));
+        snprintf(gs.name, sizeof(gs.name), "%s", sc->name);
+        gs.frames = frames;
+        ok = ok && fwrite(&gs, sizeof(gs), 1, f) == 1 && fwrite(out.data(), sizeof(float), out.size(), f) == out.size();
+    }
+    ok = (fclose(f) == 0) && ok;
+    printf("golden: referência %s em %s (bloco %u, %.0f Hz, %.1f s por cenário)\n",
+           ok ? "gravada" : "NÃO gravada", path, block, rate, seconds);
+    return ok;
+}
+
+static bool golden_check(const char* path, const LV2_Descriptor* desc, const char* bundle,
+                         const LV2_Feature* const* features, double tol) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        printf("golden: %s não existe (gere com --golden-write ou make bench-golden)\n", path);
+        printf("golden: FALHOU\n");
+        return false;
+    }
+    GoldenHeader h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || std::memcmp(h.magic, GOLDEN_MAGIC, 8) != 0) {
+        fprintf(stderr, "mydrumkit-bench: %s não é uma referência válida\n", path);
+        fclose(f);
+        return false;
+    }
+
+    bool ok = true;
+    for (uint32_t i = 0; i < h.n_scenarios; ++i) {
+        GoldenScenario gs;
+        if (fread(&gs, sizeof(gs), 1, f) != 1) {
+            ok = false;
+            break;
+        }
+        gs.name[sizeof(gs.name) - 1] = '\0';
+        std::vector<float> ref(gs.frames * NUM_OUTPUTS);
+        if (fread(ref.data(), sizeof(float), ref.size(), f) != ref.size()) {
+            ok = false;
+            break;
+        }
+        const Scenario* sc = find_scenario(gs.name);
+        Instance inst;
+        if (!sc || !inst.open(desc, bundle, features, h.rate, h.block)) {
+            ok = false;
+            break;
+        }
+        std::vector<float> out;
+        play(inst, sc->make(h.rate, h.seconds), gs.frames, &out);
+
+        double maxdiff = 0.0;
+        uint64_t n_diff = 0;
+        for (size_t k = 0; k < ref.size(); ++k) {
+            double d = fabs((double)out[k] - (double)ref[k]);
+            if (d > 0.0) ++n_diff;
+            maxdiff = std::max(maxdiff, d);
+        }
+        bool pass = maxdiff <= tol;
+        ok = ok && pass;
+        if (n_diff == 0) {
+            printf("golden: %-8s idêntico\n", gs.name);
+        } else {
+            printf("golden: %-8s %s: diferença máxima %.3g (%llu amostras diferentes, tolerância %.3g)\n",
+                   gs.name, pass ? "ok" : "FALHOU", maxdiff, (unsigned long long)n_diff, tol);
+        }
+    }
+    fclose(f);
+    if (!ok) printf("golden: FALHOU\n");
+    return ok;
+}
+
+// Somas da saída: uma linha de parâmetros e, por cenário, nome, frames e o
+// FNV-1a de 64 bits das amostras float (bits exatos, na ordem planar)
+
+static uint64_t fnv1a(const std::vector<float>& out) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const unsigned char* p = (const unsigned char*)out.data();
+    for (size_t k = 0; k < out.size() * sizeof(float); ++k) {
+        h ^= p[k];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static bool sum_write(const char* path, const LV2_Descriptor* desc, const char* bundle,
+                      const LV2_Feature* const* features, const std::vector<const Scenario*>& scenarios,
+                      double rate, double seconds, uint32_t block) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "mydrumkit-bench: não foi possível criar %s\n", path);
+        return false;
+    }
+    fprintf(f, "# mydrumkit-bench: FNV-1a 64 da saída de cada cenário (make bench-golden)\n");
+    fprintf(f, "params %.17g %.17g %u\n", rate, seconds, block);
+    bool ok = true;
+    for (const Scenario* sc : scenarios) {
+        Instance inst;
+        if (!inst.open(desc, bundle, features, rate, block)) {
+            ok = false;
+            break;
+        }
+        uint64_t frames = (uint64_t)(seconds * rate);
+        std::vector<float> out;
+        play(inst, sc->make(rate, seconds), frames, &out);
+        fprintf(f, "%s %llu %016llx\n", sc->name, (unsigned long long)frames, (unsigned long long)fnv1a(out));
+    }
+    ok = (fclose(f) == 0) && ok;
+    printf("golden: somas %s em %s\n", ok ? "gravadas" : "NÃO gravadas", path);
+    return ok;
+}
+
+static bool sum_check(const char* path, const LV2_Descriptor* desc, const char* bundle,
+                      const LV2_Feature* const* features) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        printf("golden: %s não existe (gere com --sum-write ou make bench-golden)\n", path);
+        printf("golden: FALHOU\n");
+        return false;
+    }
+    char line[256];
+    double rate = 0.0, seconds = 0.0;
+    uint32_t block = 0;
+    int n_scenarios = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (!strncmp(line, "params ", 7)) {
+            if (sscanf(line + 7, "%lf %lf %u", &rate, &seconds, &block) != 3) ok = false;
+            continue;
+        }
+        char name[16];
+        unsigned long long frames, sum;
+        if (sscanf(line, "%15s %llu %llx", name, &frames, &sum) != 3 || block == 0) {
+            fprintf(stderr, "mydrumkit-bench: linha inválida em %s: %s", path, line);
+            ok = false;
+            break;
+        }
+        const Scenario* sc = find_scenario(name);
+        Instance inst;
+        if (!sc || !inst.open(desc, bundle, features, rate, block)) {
+            ok = false;
+            break;
+        }
+        std::vector<float> out;
+        play(inst, sc->make(rate, seconds), frames, &out);
+        uint64_t got = fnv1a(out);
+        ++n_scenarios;
+        if (got == sum) {
+            printf("golden: %-8s soma idêntica\n", name);
+        } else {
+            printf("golden: %-8s FALHOU: soma %016llx, esperada %016llx\n", name, (unsigned long long)got, sum);
+            ok = false;
+        }
+    }
+    fclose(f);
+    if (n_scenarios == 0) ok = false;
+    if (!ok) printf("golden: FALHOU\n");
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+
+static std::vector<std::string> split(const char* list) {
+    std::vector<std::string> out;
+    std::string cur;
+    for (const char* p = list;; ++p) {
+        if (*p == ',' || *p == '\0') {
+            if (!cur.empty()) out.push_back(cur);
+            cur.clear();
+            if (!*p) break;
+        } else {
+            cur += *p;
+        }
+    }
+    return out;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argv[1][0] == '-') {
+        fprintf(stderr, "Uso: %s <bundle> [-b blocos] [-r taxa] [-s cenários] [-t segundos] [--simd] [--storage]\n"
+                        "       [--golden ARQ | --golden-write ARQ] [--sum ARQ | --sum-write ARQ] [--tol X] [--realtime]\n",
+                argv[0]);
+        return 1;
+    }
+    const char* bundle = argv[1];
+    std::vector<uint32_t> blocks = { 256 };
+    double rate = 44100.0;
+    double seconds = 6.0;
+    double tol = 0.0;
+    bool simd = false;
+    bool storage = false;
+    const char* golden = nullptr;
+    const char* golden_out = nullptr;
+    const char* sum = nullptr;
+    const char* sum_out = nullptr;
+    std::vector<const Scenario*> scenarios;
+
+    for (int i = 2; i < argc; ++i) {
+        const char* a = argv[i];
+        const char* v = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!strcmp(a, "--simd")) {
+            simd = true;
+            continue;
+        }
+        if (!strcmp(a, "--storage")) {
+            storage = true;
+            continue;
+        }
+        if (!strcmp(a, "--realtime")) {
+            realtime = true;
+            continue;
+        }
+        if (!v) {
+            fprintf(stderr, "mydrumkit-bench: %s requer um valor\n", a);
+            return 1;
+        }
+        ++i;
+        if (!strcmp(a, "-b")) {
+            blocks.clear();
+            for (const std::string& b : split(v)) blocks.push_back((uint32_t)atoi(b.c_str()));
+        } else if (!strcmp(a, "-r")) {
+            rate = atof(v);
+        } else if (!strcmp(a, "-t")) {
+            seconds = atof(v);
+        } else if (!strcmp(a, "-s")) {
+            for (const std::string& s : split(v)) {
+                const Scenario* sc = find_scenario(s.c_str());
+                if (!sc) {
+                    fprintf(stderr, "mydrumkit-bench: cenário desconhecido: %s\n", s.c_str());
+                    return 1;
+                }
+                scenarios.push_back(sc);
+            }
+        } else if (!strcmp(a, "--golden")) {
+            golden = v;
+        } else if (!strcmp(a, "--golden-write")) {
+            golden_out = v;
+        } else if (!strcmp(a, "--sum")) {
+            sum = v;
+        } else if (!strcmp(a, "--sum-write")) {
+            sum_out = v;
+        } else if (!strcmp(a, "--tol")) {
+            tol = atof(v);
+        } else {
+            fprintf(stderr, "mydrumkit-bench: opção desconhecida: %s\n", a);
+            return 1;
+        }
+    }
+    if (scenarios.empty()) {
+        for (const Scenario& s : SCENARIOS) scenarios.push_back(&s);
+    }
+    for (uint32_t b : blocks) {
+        if (b == 0 || b > 65536) {
+            fprintf(stderr, "mydrumkit-bench: tamanho de bloco inválido\n");
+            return 1;
+        }
+    }
+
+    LV2_URID_Map map = { nullptr, map_uri };
+    LV2_Feature map_feature = { LV2_URID__map, &map };
+    const LV2_Feature* features[] = { &map_feature, nullptr };
+    const LV2_Descriptor* desc = lv2_descriptor(0);
+    if (const char* e = getenv("MYDRUMKIT_SIMD")) env_simd = strdup(e);
+    if (const char* e = getenv("MYDRUMKIT_STORAGE")) env_storage = strdup(e);
+
+    // A primeira instância paga a carga (decodificação ou cache de kit) e fica
+    // aberta, para que as demais reutilizem os samples já no processo
+    Instance hold;
+    if (!hold.open(desc, bundle, features, rate, blocks[0])) {
+        fprintf(stderr, "mydrumkit-bench: falha ao instanciar o plugin\n");
+        return 1;
+    }
+    Instance warm;
+    warm.open(desc, bundle, features, rate, blocks[0]);
+    warm.close();
+    printf("instanciação: instantiate() %.2f ms, carga %.1f ms (primeira); %.2f ms, %.1f ms (samples já no processo)\n",
+           hold.instantiate_ms, hold.load_ms, warm.instantiate_ms, warm.load_ms);
+
+    static const char* const kernels[] = { "scalar", "sse", "avx2" };
+    std::vector<const char*> variants;
+    if (simd) variants.assign(kernels, kernels + 3);
+    else variants.push_back(nullptr);
+
+    static const char* const formats[] = { "float", "int16" };
+    std::vector<const char*> storages;
+    if (storage) storages.assign(formats, formats + 2);
+    else storages.push_back(nullptr);
+
+    // Memória dos samples em cada formato (a instância fica aberta para as medições)
+    std::vector<Instance> held(storages.size());
+    for (size_t f = 0; f < storages.size(); ++f) {
+        set_storage(storages[f]);
+        if (!held[f].open(desc, bundle, features, rate, blocks[0])) return 1;
+        printf("samples (%s): %.1f MB residentes\n", storages[f] ? storages[f] : "padrão",
+               mydrumkit_bench_sample_bytes(held[f].handle) / 1048576.0);
+    }
+
+    printf("\n%-8s %6s %-8s %-7s %10s %13s %7s %12s %9s\n",
+           "cenário", "bloco", "kernel", "formato", "ns/frame", "ns/voz·frame", "vozes", "pior (us)", "% bloco");
+    for (const Scenario* sc : scenarios) {
+        std::vector<NoteEvent> events = sc->make(rate, seconds);
+        uint64_t frames = (uint64_t)(seconds * rate);
+        for (uint32_t block : blocks) {
+            for (const char* k : variants) {
+                for (const char* fmt : storages) {
+                    set_simd(k);
+                    set_storage(fmt);
+                    Instance inst;
+                    if (!inst.open(desc, bundle, features, rate, block)) return 1;
+                    Stats st = play(inst, events, frames, nullptr);
+                    double block_ns = block * 1e9 / rate;
+                    printf("%-8s %6u %-8s %-7s %10.2f %13.3f %7.1f %12.1f %8.1f%%\n",
+                           sc->name, block, k ? k : "auto", fmt ? fmt : "-", st.run_ns / st.frames,
+                           st.voice_frames > 0 ? st.run_ns / st.voice_frames : 0.0,
+                           st.voice_frames / st.frames, st.worst_ns / 1000.0, 100.0 * st.worst_ns / block_ns);
+                }
+            }
+        }
+    }
+    set_simd(env_simd);
+    set_storage(env_storage);
+    printf("\n");
+
+    bool ok = true;
+    if (golden_out) ok = golden_write(golden_out, desc, bundle, features, scenarios, rate, seconds, blocks[0]);
+    if (golden) ok = golden_check(golden, desc, bundle, features, tol) && ok;
+    if (sum_out) ok = sum_write(sum_out, desc, bundle, features, scenarios, rate, seconds, blocks[0]) && ok;
+    if (sum) ok = sum_check(sum, desc, bundle, features) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+// mydrumkit-cache: gera o cache de kit pré-decodificado fora do host.
+//
+// Instancia o plugin pelo próprio descritor LV2 (o mesmo código usado pelo
+// host), espera o carregamento terminar e encerra. O cache é gravado pelo
+// plugin no diretório padrão (ou em MYDRUMKIT_CACHE_DIR).
+//
+// A ferramenta oferece um worker síncrono: a carga só começa quando ela
+// chama o work() do plugin, depois de apagar o cache anterior, então um
+// arquivo antigo nunca passa por um cache recém-gravado. Falha se a carga
+// não terminar em LOAD_TIMEOUT_S ou se o arquivo de cache não existir (ou
+// estiver vazio) depois do cleanup.
+//
+// Uso: mydrumkit-cache <bundle> [taxa ...]    (padrão: 44100 48000)
+
+#include <lv2/core/lv2.h>
+#include <lv2/atom/atom.h>
+#include <lv2/urid/urid.h>
+#include <lv2/worker/worker.h>
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <chrono>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NUM_OUTPUTS 12
+#define PORT_PROGRESS (NUM_OUTPUTS + 1)
+#define BLOCK 256
+#define LOAD_TIMEOUT_S 600
+
+extern "C" void mydrumkit_bench_cache_path(LV2_Handle instance, char* buf, size_t size);
+
+static std::vector<std::string> uris;
+
+static LV2_URID map_uri(LV2_URID_Map_Handle, const char* uri) {
+    for (size_t i = 0; i < uris.size(); ++i) {
+        if (uris[i] == uri) return (LV2_URID)(i + 1);
+    }
+    uris.push_back(uri);
+    return (LV2_URID)uris.size();
+}
+
+// Worker: o schedule_work() só enfileira; a ferramenta executa os pedidos
+// entre dois run()
+typedef std::vector<std::vector<uint8_t>> WorkQueue;
+
+static LV2_Worker_Status schedule_work(LV2_Worker_Schedule_Handle handle, uint32_t size, const void* data) {
+    const uint8_t* p = (const uint8_t*)data;
+    ((WorkQueue*)handle)->emplace_back(p, p + size);
+    return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status respond(LV2_Worker_Respond_Handle, uint32_t, const void*) {
+    return LV2_WORKER_SUCCESS;
+}
+
+static bool build_cache(const LV2_Descriptor* desc, const char* bundle, double rate) {
+    LV2_URID_Map map = { nullptr, map_uri };
+    LV2_Feature map_feature = { LV2_URID__map, &map };
+    WorkQueue queue;
+    LV2_Worker_Schedule schedule = { &queue, schedule_work };
+    LV2_Feature schedule_feature = { LV2_WORKER__schedule, &schedule };
+    const LV2_Feature* features[] = { &map_feature, &schedule_feature, nullptr };
+    const LV2_Worker_Interface* worker = (const LV2_Worker_Interface*)desc->extension_data(LV2_WORKER__interface);
+
+    LV2_Handle h = desc->instantiate(desc, rate, bundle, features);
+    if (!h) {
+        fprintf(stderr, "mydrumkit-cache: falha ao instanciar o plugin\n");
+        return false;
+    }
+    char path[4096];
+    mydrumkit_bench_cache_path(h, path, sizeof(path));
+    if (path[0] && unlink(path) != 0 && errno != ENOENT) {
+        fprintf(stderr, "mydrumkit-cache: não foi possível apagar o cache anterior %s: %s\n", path, strerror(errno));
+        desc->cleanup(h);
+        return false;
+    }
+
+    // Portas: sequência MIDI vazia, saídas descartadas e progresso
+    LV2_Atom_Sequence seq;
+    std::memset(&seq, 0, sizeof(seq));
+    seq.atom.size = sizeof(LV2_Atom_Sequence_Body);
+    seq.atom.type = map_uri(nullptr, LV2_ATOM__Sequence);
+    std::vector<float> audio(BLOCK * NUM_OUTPUTS);
+    float progress = 0.0f;
+
+    desc->connect_port(h, 0, &seq);
+    for (int i = 0; i < NUM_OUTPUTS; ++i) desc->connect_port(h, 1 + i, &audio[i * BLOCK]);
+    desc->connect_port(h, PORT_PROGRESS, &progress);
+    if (desc->activate) desc->activate(h);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(LOAD_TIMEOUT_S);
+    bool timeout = false;
+    while (progress < 100.0f) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            timeout = true;
+            break;
+        }
+        desc->run(h, BLOCK);
+        WorkQueue pending;
+        pending.swap(queue);
+        for (const std::vector<uint8_t>& w : pending) worker->work(h, respond, nullptr, (uint32_t)w.size(), w.data());
+        if (pending.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    // O cleanup() interrompe a carga e espera a thread de carga
+    if (desc->deactivate) desc->deactivate(h);
+    desc->cleanup(h);
+    if (timeout) {
+        fprintf(stderr, "mydrumkit-cache: carga não terminou em %d s (%.0f%%)\n", LOAD_TIMEOUT_S, progress);
+        return false;
+    }
+
+    struct stat st;
+    if (!path[0] || stat(path, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "mydrumkit-cache: cache de kit não foi gravado: %s\n", path[0] ? path : "(sem diretório de cache)");
+        return false;
+    }
+    fprintf(stderr, "mydrumkit-cache: %s (%.1f MB)\n", path, st.st_size / 1048576.0);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Uso: %s <bundle> [taxa ...]\n", argv[0]);
+        return 1;
+    }
+
+    const LV2_Descriptor* desc = lv2_descriptor(0);
+    std::vector<double> rates;
+    for (int i = 2; i < argc; ++i) rates.push_back(atof(argv[i]));
+    if (rates.empty()) rates = { 44100.0, 48000.0 };
+
+    for (double rate : rates) {
+        fprintf(stderr, "mydrumkit-cache: gerando cache para %.0f Hz\n", rate);
+        if (!build_cache(desc, argv[1], rate)) return 1;
+    }
+    return 0;
+}
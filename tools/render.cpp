@@ -0,0 +1,669 @@
+// mydrumkit-render: render offline de arquivos MIDI (SMF) para stems WAV.
+//
+// Host sem interface que carrega o plugin pelo descritor LV2 (o mesmo run()
+// usado no host) e grava as 12 saídas, uma por arquivo (padrão) ou todas em
+// um WAV multicanal, via libsndfile.
+//
+// O arquivo é dividido em segmentos de tempo independentes, renderizados em
+// paralelo, cada um em uma instância própria do plugin (os samples são
+// compartilhados no processo). Cada segmento começa antes do seu início
+// (pré-rolagem, por padrão o maior sample do kit) tocando as notas dessa
+// janela, para que as caudas das vozes que atravessam a fronteira saiam
+// completas; as notas anteriores à pré-rolagem só avançam o round robin.
+// O resultado é igual ao render contínuo, exceto quando a polifonia satura
+// e o roubo de voz depende de vozes fora da pré-rolagem.
+//
+// Uso: mydrumkit-render <bundle> [opções] arquivo.mid...
+//   -o DIR          diretório de saída (padrão: o do arquivo MIDI)
+//   -k KIT          arquivo de kit (como MYDRUMKIT_KIT)
+//   -r 44100        taxa de amostragem
+//   -b 4096         tamanho de bloco do run()
+//   -j N            threads (padrão: núcleos disponíveis)
+//   -c N            só o canal MIDI N (1-16; padrão: todos)
+//   --segment S     duração de cada segmento em segundos (padrão: o arquivo
+//                   dividido entre as threads, no mínimo 10 s)
+//   --preroll S     pré-rolagem de cada segmento em segundos
+//   --multi         um WAV com as 12 saídas em vez de um por saída
+//   --pcm16/--pcm24 inteiro em vez de float 32 bits
+
+#include <lv2/core/lv2.h>
+#include <lv2/atom/atom.h>
+#include <lv2/midi/midi.h>
+#include <lv2/urid/urid.h>
+#include <sndfile.h>
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <cmath>
+
+#define NUM_OUTPUTS 12
+#define PORT_PROGRESS (NUM_OUTPUTS + 1)
+#define PORT_ACTIVITY (NUM_OUTPUTS + 16)
+
+extern "C" uint32_t mydrumkit_bench_active_voices(LV2_Handle instance);
+extern "C" uint32_t mydrumkit_bench_max_sample_frames(LV2_Handle instance);
+extern "C" void mydrumkit_bench_skip_note(LV2_Handle instance, uint8_t note, uint8_t vel);
+
+typedef std::chrono::steady_clock Clock;
+
+// Nomes das saídas, como em mydrumkit.ttl
+static const char* const OUTPUT_NAMES[NUM_OUTPUTS] = {
+    "Kick", "Snare", "HiHat", "Snare FX", "RackTom1", "RackTom2", "RackTom3",
+    "FloorTom1", "FloorTom2", "FloorTom3", "Overhead L", "Overhead R"
+};
+
+static std::vector<std::string> uris;
+static std::mutex uris_mutex;
+
+// Chamado pelas instâncias de várias threads
+static LV2_URID map_uri(LV2_URID_Map_Handle, const char* uri) {
+    std::lock_guard<std::mutex> lock(uris_mutex);
+    for (size_t i = 0; i < uris.size(); ++i) {
+        if (uris[i] == uri) return (LV2_URID)(i + 1);
+    }
+    uris.push_back(uri);
+    return (LV2_URID)uris.size();
+}
+
+static double ms_since(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// ---------------------------------------------------------------------------
+// Standard MIDI File (formatos 0 e 1)
+
+struct MidiEvent {
+    uint64_t frame;
+    uint8_t msg[3];
+};
+
+struct SmfReader {
+    const uint8_t* p;
+    const uint8_t* end;
+
+    bool has(size_t n) const { return (size_t)(end - p) >= n; }
+    uint32_t be(int n) {
+        uint32_t v = 0;
+        for (int i = 0; i < n; ++i) v = (v << 8) | *p++;
+        return v;
+    }
+    bool varlen(uint32_t& v) {
+        v = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (p >= end) return false;
+            uint8_t b = *p++;
+            v = (v << 7) | (b & 0x7F);
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+};
+
+struct TickEvent {
+    uint64_t tick;
+    uint32_t order;  // desempate estável: trilha e posição na trilha
+    uint8_t msg[3];
+};
+
+struct TempoChange {
+    uint64_t tick;
+    uint32_t order;
+    uint32_t usec_per_quarter;
+};
+
+// Lê as notas (NOTE ON) e o aftertouch polifônico, que o plugin usa, de
+// todas as trilhas, e converte os ticks em frames pelo mapa de tempo.
+// `channel` 0 aceita todos os canais. Retorna false com o erro em `error`.
+static bool read_smf(const char* path, double rate, int channel, std::vector<MidiEvent>& out, std::string& error) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        error = strerror(errno);
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+    fclose(f);
+
+    SmfReader r = { data.data(), data.data() + data.size() };
+    if (!r.has(14) || std::memcmp(r.p, "MThd", 4) != 0) {
+        error = "não é um arquivo MIDI (MThd)";
+        return false;
+    }
+    r.p += 4;
+    uint32_t header_len = r.be(4);
+    if (header_len < 6 || !r.has(header_len)) {
+        error = "cabeçalho MThd inválido";
+        return false;
+    }
+    const uint8_t* header_end = r.p + header_len;
+    uint32_t format = r.be(2);
+    uint32_t n_tracks = r.be(2);
+    uint32_t division = r.be(2);
+    r.p = header_end;
+    if (format > 1) {
+        error = "formato SMF 2 não suportado";
+        return false;
+    }
+
+    // Divisão em ticks por semínima, ou SMPTE (quadros por segundo x ticks por quadro)
+    double smpte_ticks_per_sec = 0.0;
+    if (division & 0x8000) {
+        int fps = -(int8_t)(division >> 8);
+        smpte_ticks_per_sec = (fps == 29 ? 29.97 : fps) * (division & 0xFF);
+        if (smpte_ticks_per_sec <= 0.0) {
+            error = "divisão SMPTE inválida";
+            return false;
+        }
+    } else if (division == 0) {
+        error = "divisão de tempo zero";
+        return false;
+    }
+
+    std::vector<TickEvent> events;
+    std::vector<TempoChange> tempo;
+    uint32_t order = 0;
+    for (uint32_t t = 0; t < n_tracks && r.has(8); ++t) {
+        if (std::memcmp(r.p, "MTrk", 4) != 0) {
+            error = "trilha sem MTrk";
+            return false;
+        }
+        r.p += 4;
+        uint32_t len = r.be(4);
+        if (!r.has(len)) {
+            error = "trilha truncada";
+            return false;
+        }
+        SmfReader tr = { r.p, r.p + len };
+        r.p += len;
+
+        uint64_t tick = 0;
+        uint8_t running = 0;
+        while (tr.p < tr.end) {
+            uint32_t delta;
+            if (!tr.varlen(delta) || tr.p >= tr.end) break;
+            tick += delta;
+
+            uint8_t status = *tr.p;
+            if (status == 0xFF) {  // meta evento
+                if (!tr.has(2)) break;
+                uint8_t type = tr.p[1];
+                tr.p += 2;
+                uint32_t mlen;
+                if (!tr.varlen(mlen) || !tr.has(mlen)) break;
+                if (type == 0x51 && mlen == 3) {
+                    uint32_t us = ((uint32_t)tr.p[0] << 16) | ((uint32_t)tr.p[1] << 8) | tr.p[2];
+                    if (us > 0) tempo.push_back({tick, order++, us});
+                }
+                tr.p += mlen;
+                if (type == 0x2F) break;  // fim da trilha
+                continue;
+            }
+            if (status == 0xF0 || status == 0xF7) {  // sysex
+                ++tr.p;
+                uint32_t slen;
+                if (!tr.varlen(slen) || !tr.has(slen)) break;
+                tr.p += slen;
+                running = 0;
+                continue;
+            }
+
+            if (status & 0x80) {
+                running = status;
+                ++tr.p;
+            } else if (!running) {
+                break;  // dado sem status
+            }
+            uint8_t kind = running & 0xF0;
+            int n_data = (kind == 0xC0 || kind == 0xD0) ? 1 : 2;
+            if (!tr.has(n_data)) break;
+            uint8_t d1 = tr.p[0];
+            uint8_t d2 = n_data > 1 ? tr.p[1] : 0;
+            tr.p += n_data;
+
+            if (channel > 0 && (running & 0x0F) != channel - 1) continue;
+            if ((kind == 0x90 && d2 > 0) || kind == 0xA0) {
+                events.push_back({tick, order++, { running, d1, d2 }});
+            }
+        }
+        if (format == 0) break;
+    }
+
+    std::stable_sort(tempo.begin(), tempo.end(), [](const TempoChange& a, const TempoChange& b) {
+        return a.tick < b.tick;
+    });
+    std::stable_sort(events.begin(), events.end(), [](const TickEvent& a, const TickEvent& b) {
+        return a.tick < b.tick || (a.tick == b.tick && a.order < b.order);
+    });
+
+    // Ticks -> segundos, somando os trechos de cada tempo
+    out.clear();
+    out.reserve(events.size());
+    size_t ti = 0;
+    uint64_t seg_tick = 0;
+    double seg_sec = 0.0;
+    double usec = 500000.0;  // 120 bpm até o primeiro evento de tempo
+    for (const TickEvent& e : events) {
+        double sec;
+        if (smpte_ticks_per_sec > 0.0) {
+            sec = e.tick / smpte_ticks_per_sec;
+        } else {
+            while (ti < tempo.size() && tempo[ti].tick <= e.tick) {
+                seg_sec += (double)(tempo[ti].tick - seg_tick) * usec / 1e6 / division;
+                seg_tick = tempo[ti].tick;
+                usec = tempo[ti].usec_per_quarter;
+                ++ti;
+            }
+            sec = seg_sec + (double)(e.tick - seg_tick) * usec / 1e6 / division;
+        }
+        MidiEvent m;
+        m.frame = (uint64_t)llround(sec * rate);
+        std::memcpy(m.msg, e.msg, 3);
+        out.push_back(m);
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Instância do plugin
+
+struct Instance {
+    const LV2_Descriptor* desc;
+    LV2_Handle handle;
+    uint32_t block;
+    std::vector<float> audio;
+    std::vector<uint64_t> seq_buf;
+    float progress;
+    float activity;  // saídas com som no último bloco (bit c = saída c)
+
+    Instance() : desc(nullptr), handle(nullptr), block(0), progress(0.0f), activity(0.0f) {}
+    ~Instance() { close(); }
+
+    bool open(const LV2_Descriptor* d, const char* bundle, const LV2_Feature* const* features,
+              double sample_rate, uint32_t block_size) {
+        desc = d;
+        block = block_size;
+        audio.assign((size_t)block * NUM_OUTPUTS, 0.0f);
+
+        handle = desc->instantiate(desc, sample_rate, bundle, features);
+        if (!handle) return false;
+
+        set_events(nullptr, 0, 0);
+        desc->connect_port(handle, 0, seq_buf.data());
+        for (int i = 0; i < NUM_OUTPUTS; ++i) desc->connect_port(handle, 1 + i, &audio[i * block]);
+        desc->connect_port(handle, PORT_PROGRESS, &progress);
+        desc->connect_port(handle, PORT_ACTIVITY, &activity);
+        if (desc->activate) desc->activate(handle);
+
+        // Sem eventos até a carga terminar: estes blocos são só silêncio
+        while (progress < 100.0f) {
+            desc->run(handle, block);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    void close() {
+        if (!handle) return;
+        if (desc->deactivate) desc->deactivate(handle);
+        desc->cleanup(handle);
+        handle = nullptr;
+    }
+
+    // Monta a sequência MIDI do bloco que começa em `start` com os eventos [ev, ev + n)
+    void set_events(const MidiEvent* ev, size_t n, uint64_t start) {
+        struct SeqEvent {
+            LV2_Atom_Event ev;
+            uint8_t msg[8];
+        };
+        size_t words = (sizeof(LV2_Atom_Sequence) + n * sizeof(SeqEvent)) / sizeof(uint64_t) + 1;
+        if (seq_buf.size() < words) {
+            seq_buf.resize(std::max<size_t>(words, 64));
+            if (handle) desc->connect_port(handle, 0, seq_buf.data());
+        }
+
+        LV2_Atom_Sequence* seq = (LV2_Atom_Sequence*)seq_buf.data();
+        seq->atom.type = map_uri(nullptr, LV2_ATOM__Sequence);
+        seq->atom.size = sizeof(LV2_Atom_Sequence_Body);
+        seq->body.unit = 0;
+        seq->body.pad = 0;
+        SeqEvent* out = (SeqEvent*)LV2_ATOM_CONTENTS(LV2_Atom_Sequence, seq);
+        LV2_URID midi_type = map_uri(nullptr, LV2_MIDI__MidiEvent);
+        for (size_t i = 0; i < n; ++i, ++out) {
+            std::memset(out, 0, sizeof(*out));
+            out->ev.time.frames = (int64_t)(ev[i].frame - start);
+            out->ev.body.type = midi_type;
+            out->ev.body.size = 3;
+            std::memcpy(out->msg, ev[i].msg, 3);
+            seq->atom.size += sizeof(SeqEvent);
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Render em segmentos
+
+struct Segment {
+    uint64_t begin;            // primeiro frame de saída
+    uint64_t end;              // fim (exclusivo)
+    std::vector<float> audio;  // planar: saída c em [c * (end - begin), ...)
+    bool ok;
+    bool done;
+};
+
+struct RenderJob {
+    const LV2_Descriptor* desc;
+    const char* bundle;
+    const LV2_Feature* const* features;
+    double rate;
+    uint32_t block;
+    uint64_t preroll;
+    const std::vector<MidiEvent>* events;
+    std::vector<Segment> segments;
+    std::atomic<size_t> next;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    RenderJob() : desc(nullptr), bundle(nullptr), features(nullptr), rate(0.0), block(0), preroll(0),
+                  events(nullptr), next(0) {}
+};
+
+// Renderiza um segmento em uma instância própria: avança o round robin com
+// as notas anteriores, toca a pré-rolagem (descartada) e guarda [begin, end)
+static bool render_segment(RenderJob& job, Segment& seg) {
+    Instance inst;
+    if (!inst.open(job.desc, job.bundle, job.features, job.rate, job.block)) return false;
+
+    const std::vector<MidiEvent>& events = *job.events;
+    uint64_t start = seg.begin > job.preroll ? seg.begin - job.preroll : 0;
+    size_t next = 0;
+    for (; next < events.size() && events[next].frame < start; ++next) {
+        const uint8_t* msg = events[next].msg;
+        if ((msg[0] & 0xF0) == 0x90) mydrumkit_bench_skip_note(inst.handle, msg[1], msg[2]);
+    }
+
+    uint64_t frames = seg.end - seg.begin;
+    seg.audio.assign(frames * NUM_OUTPUTS, 0.0f);
+    for (uint64_t pos = start; pos < seg.end; pos += inst.block) {
+        uint32_t n = (uint32_t)std::min<uint64_t>(inst.block, seg.end - pos);
+        size_t first = next;
+        while (next < events.size() && events[next].frame < pos + n) ++next;
+        inst.set_events(events.data() + first, next - first, pos);
+        inst.desc->run(inst.handle, n);
+
+        // Parte do bloco dentro do segmento (a pré-rolagem é descartada)
+        if (pos + n <= seg.begin) continue;
+        uint32_t skip = pos < seg.begin ? (uint32_t)(seg.begin - pos) : 0;
+        uint32_t active = (uint32_t)inst.activity;
+        for (int c = 0; c < NUM_OUTPUTS; ++c) {
+            if (!(active & (1u << c))) continue;  // silêncio: o segmento já está zerado
+            std::memcpy(&seg.audio[c * frames + (pos + skip - seg.begin)], &inst.audio[c * inst.block + skip],
+                        (n - skip) * sizeof(float));
+        }
+    }
+    return true;
+}
+
+static void render_worker(RenderJob* job) {
+    for (;;) {
+        size_t i = job->next.fetch_add(1);
+        if (i >= job->segments.size()) return;
+        Segment& seg = job->segments[i];
+        bool ok = render_segment(*job, seg);
+        std::lock_guard<std::mutex> lock(job->mutex);
+        seg.ok = ok;
+        seg.done = true;
+        job->cond.notify_all();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Saída WAV
+
+struct Output {
+    std::vector<SNDFILE*> files;  // um por saída, ou um multicanal
+    std::vector<float> interleaved;
+
+    ~Output() { close(); }
+
+    bool open(const std::string& base, bool multi, int format, double rate) {
+        SF_INFO info{};
+        info.samplerate = (int)rate;
+        info.format = SF_FORMAT_WAV | format;
+        if (multi) {
+            info.channels = NUM_OUTPUTS;
+            std::string path = base + ".wav";
+            SNDFILE* f = sf_open(path.c_str(), SFM_WRITE, &info);
+            if (!f) {
+                fprintf(stderr, "mydrumkit-render: erro ao criar %s: %s\n", path.c_str(), sf_strerror(nullptr));
+                return false;
+            }
+            files.push_back(f);
+            return true;
+        }
+        info.channels = 1;
+        for (int c = 0; c < NUM_OUTPUTS; ++c) {
+            char name[256];
+            snprintf(name, sizeof(name), "%s-%02d-%s.wav", base.c_str(), c + 1, OUTPUT_NAMES[c]);
+            for (char* p = name + base.size(); *p; ++p) {
+                if (*p == ' ') *p = '_';
+            }
+            SNDFILE* f = sf_open(name, SFM_WRITE, &info);
+            if (!f) {
+                fprintf(stderr, "mydrumkit-render: erro ao criar %s: %s\n", name, sf_strerror(nullptr));
+                return false;
+            }
+            files.push_back(f);
+        }
+        return true;
+    }
+
+    bool write(const Segment& seg) {
+        uint64_t frames = seg.end - seg.begin;
+        if (files.size() == 1 && NUM_OUTPUTS > 1) {
+            interleaved.resize(frames * NUM_OUTPUTS);
+            for (uint64_t k = 0; k < frames; ++k) {
+                for (int c = 0; c < NUM_OUTPUTS; ++c) interleaved[k * NUM_OUTPUTS + c] = seg.audio[c * frames + k];
+            }
+            return sf_writef_float(files[0], interleaved.data(), frames) == (sf_count_t)frames;
+        }
+        for (size_t c = 0; c < files.size(); ++c) {
+            if (sf_writef_float(files[c], &seg.audio[c * frames], frames) != (sf_count_t)frames) return false;
+        }
+        return true;
+    }
+
+    void close() {
+        for (SNDFILE* f : files) sf_close(f);
+        files.clear();
+    }
+};
+
+// ---------------------------------------------------------------------------
+
+static unsigned default_threads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+static std::string output_base(const char* midi_path, const char* out_dir) {
+    std::string path(midi_path);
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? std::string(".") : path.substr(0, slash);
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.rfind('.');
+    if (dot != std::string::npos && dot > 0) name = name.substr(0, dot);
+    return (out_dir ? std::string(out_dir) : dir) + "/" + name;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argv[1][0] == '-') {
+        fprintf(stderr, "Uso: %s <bundle> [-o dir] [-k kit] [-r taxa] [-b bloco] [-j threads] [-c canal]\n"
+                        "       [--segment s] [--preroll s] [--multi] [--pcm16|--pcm24] arquivo.mid...\n", argv[0]);
+        return 1;
+    }
+    const char* bundle = argv[1];
+    const char* out_dir = nullptr;
+    double rate = 44100.0;
+    uint32_t block = 4096;
+    unsigned threads = default_threads();
+    int channel = 0;
+    double segment_sec = 0.0;
+    double preroll_sec = -1.0;
+    bool multi = false;
+    int format = SF_FORMAT_FLOAT;
+    std::vector<const char*> inputs;
+
+    for (int i = 2; i < argc; ++i) {
+        const char* a = argv[i];
+        if (a[0] != '-') {
+            inputs.push_back(a);
+            continue;
+        }
+        if (!strcmp(a, "--multi")) {
+            multi = true;
+            continue;
+        }
+        if (!strcmp(a, "--pcm16")) {
+            format = SF_FORMAT_PCM_16;
+            continue;
+        }
+        if (!strcmp(a, "--pcm24")) {
+            format = SF_FORMAT_PCM_24;
+            continue;
+        }
+        const char* v = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!v) {
+            fprintf(stderr, "mydrumkit-render: %s requer um valor\n", a);
+            return 1;
+        }
+        ++i;
+        if (!strcmp(a, "-o")) {
+            out_dir = v;
+        } else if (!strcmp(a, "-k")) {
+            setenv("MYDRUMKIT_KIT", v, 1);
+        } else if (!strcmp(a, "-r")) {
+            rate = atof(v);
+        } else if (!strcmp(a, "-b")) {
+            block = (uint32_t)atoi(v);
+        } else if (!strcmp(a, "-j")) {
+            threads = (unsigned)std::max(1, atoi(v));
+        } else if (!strcmp(a, "-c")) {
+            channel = atoi(v);
+        } else if (!strcmp(a, "--segment")) {
+            segment_sec = atof(v);
+        } else if (!strcmp(a, "--preroll")) {
+            preroll_sec = atof(v);
+        } else {
+            fprintf(stderr, "mydrumkit-render: opção desconhecida: %s\n", a);
+            return 1;
+        }
+    }
+    if (inputs.empty()) {
+        fprintf(stderr, "mydrumkit-render: nenhum arquivo MIDI\n");
+        return 1;
+    }
+    if (block == 0 || block > 65536 || rate <= 0.0 || channel < 0 || channel > 16) {
+        fprintf(stderr, "mydrumkit-render: parâmetros inválidos\n");
+        return 1;
+    }
+
+    // Offline não há prazo: o streaming do disco só causaria underruns. Os
+    // buffers de saída são só lidos aqui, então as saídas podem ser esparsas.
+    unsetenv("MYDRUMKIT_STREAM_MS");
+    setenv("MYDRUMKIT_SPARSE", "1", 1);
+
+    LV2_URID_Map map = { nullptr, map_uri };
+    LV2_Feature map_feature = { LV2_URID__map, &map };
+    const LV2_Feature* features[] = { &map_feature, nullptr };
+    const LV2_Descriptor* desc = lv2_descriptor(0);
+
+    // Instância que mantém os samples no processo durante todo o render
+    auto t_load = Clock::now();
+    Instance hold;
+    if (!hold.open(desc, bundle, features, rate, block)) {
+        fprintf(stderr, "mydrumkit-render: falha ao instanciar o plugin\n");
+        return 1;
+    }
+    uint64_t tail = mydrumkit_bench_max_sample_frames(hold.handle);
+    uint64_t preroll = preroll_sec >= 0.0 ? (uint64_t)(preroll_sec * rate) : tail;
+    fprintf(stderr, "mydrumkit-render: kit carregado em %.0f ms, maior sample %.2f s, pré-rolagem %.2f s\n",
+            ms_since(t_load), tail / rate, preroll / rate);
+
+    int failures = 0;
+    for (const char* input : inputs) {
+        std::vector<MidiEvent> events;
+        std::string error;
+        if (!read_smf(input, rate, channel, events, error)) {
+            fprintf(stderr, "mydrumkit-render: %s: %s\n", input, error.c_str());
+            ++failures;
+            continue;
+        }
+        uint64_t total = (events.empty() ? 0 : events.back().frame) + tail + 1;
+
+        // Segmentos: o arquivo dividido entre as threads, com no mínimo 10 s cada
+        uint64_t seg_frames = segment_sec > 0.0 ? (uint64_t)(segment_sec * rate)
+                                                : std::max<uint64_t>((uint64_t)(10.0 * rate), (total + threads - 1) / threads);
+        seg_frames = std::max<uint64_t>(seg_frames, block);
+
+        RenderJob job;
+        job.desc = desc;
+        job.bundle = bundle;
+        job.features = features;
+        job.rate = rate;
+        job.block = block;
+        job.preroll = preroll;
+        job.events = &events;
+        for (uint64_t b = 0; b < total; b += seg_frames) {
+            job.segments.push_back({b, std::min(total, b + seg_frames), {}, false, false});
+        }
+
+        std::string base = output_base(input, out_dir);
+        Output out;
+        if (!out.open(base, multi, format, rate)) {
+            ++failures;
+            continue;
+        }
+
+        auto t0 = Clock::now();
+        std::vector<std::thread> pool;
+        unsigned n_threads = (unsigned)std::min<size_t>(threads, job.segments.size());
+        for (unsigned t = 0; t < n_threads; ++t) pool.emplace_back(render_worker, &job);
+
+        // Grava os segmentos em ordem, liberando cada um depois de gravado
+        bool ok = true;
+        for (Segment& seg : job.segments) {
+            std::unique_lock<std::mutex> lock(job.mutex);
+            job.cond.wait(lock, [&] { return seg.done; });
+            lock.unlock();
+            ok = ok && seg.ok && out.write(seg);
+            std::vector<float>().swap(seg.audio);
+        }
+        for (std::thread& t : pool) t.join();
+        out.close();
+
+        double ms = ms_since(t0);
+        double seconds = total / rate;
+        if (ok) {
+            fprintf(stderr, "mydrumkit-render: %s: %zu eventos, %.1f s em %.0f ms (%.0fx tempo real, %zu segmentos, %u threads) -> %s%s\n",
+                    input, events.size(), seconds, ms, ms > 0.0 ? seconds * 1000.0 / ms : 0.0,
+                    job.segments.size(), n_threads, base.c_str(), multi ? ".wav" : "-*.wav");
+        } else {
+            fprintf(stderr, "mydrumkit-render: %s: falha no render\n", input);
+            ++failures;
+        }
+    }
+    return failures ? 1 : 0;
+}